@@ -0,0 +1,126 @@
+#pragma once
+
+#include "format.h"
+#include "interval.h"
+#include "raster.h"
+#include "tonemap.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cmath>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+namespace AiCo
+{
+    /**
+     * @brief Float HDR image that keeps the sum of every sample it was given and the number of samples per pixel.
+     * Renderers add to it across calls, so the estimate keeps converging for as long as the scene and camera stay put.
+     * Call reset() when either changes.
+     *
+     * Also keeps a running mean and variance of every pixel's luminance (Welford's algorithm), from which error()
+     * estimates how far the pixel still is from converging.
+     */
+    class accumulation_buffer
+    {
+    public:
+        int width, height;
+
+        /// Luminance below which error() measures absolute instead of relative error, so black pixels can converge.
+        static constexpr float MIN_LUMINANCE = 1e-2f;
+
+        accumulation_buffer(int width, int height) :
+        width(width), height(height), sums(size_t(width) * height, color3f(0.f)), counts(size_t(width) * height, 0),
+        lumMeans(size_t(width) * height, 0.f), lumM2s(size_t(width) * height, 0.f) {}
+
+        /// @brief Discards every sample, e.g., after the scene or the camera changed.
+        void reset()
+        {
+            std::fill(sums.begin(), sums.end(), color3f(0.f));
+            std::fill(counts.begin(), counts.end(), 0);
+            std::fill(lumMeans.begin(), lumMeans.end(), 0.f);
+            std::fill(lumM2s.begin(), lumM2s.end(), 0.f);
+        }
+
+        /// @brief Adds one radiance sample to pixel (x, y).
+        inline void add_sample(size_t x, size_t y, const color3f& sample)
+        {
+            assert(x < size_t(width) && y < size_t(height));
+            const size_t idx = y*width + x;
+            sums[idx] += sample;
+            uint32_t n = ++counts[idx];
+
+            float L = luminance(sample);
+            float delta = L - lumMeans[idx];
+            lumMeans[idx] += delta/n;
+            lumM2s[idx] += delta * (L - lumMeans[idx]);
+        }
+
+        [[nodiscard]] inline uint32_t samples(size_t x, size_t y)const
+        {
+            assert(x < size_t(width) && y < size_t(height));
+            return counts[y*width + x];
+        }
+        /// @return Average radiance of pixel (x, y), black if it has no samples yet.
+        [[nodiscard]] inline color3f mean(size_t x, size_t y)const
+        {
+            assert(x < size_t(width) && y < size_t(height));
+            uint32_t n = counts[y*width + x];
+            return n == 0 ? color3f(0.f) : sums[y*width + x]/float(n);
+        }
+
+        /// @return Unbiased sample variance of the luminance of pixel (x, y), INF with fewer than two samples.
+        [[nodiscard]] inline float variance(size_t x, size_t y)const
+        {
+            assert(x < size_t(width) && y < size_t(height));
+            uint32_t n = counts[y*width + x];
+            return n < 2 ? INF : lumM2s[y*width + x]/(n - 1);
+        }
+        /**
+         * @return Half-width of the 95% confidence interval of the mean luminance of pixel (x, y), relative to that mean.
+         * INF with fewer than two samples.
+         */
+        [[nodiscard]] inline float error(size_t x, size_t y)const
+        {
+            uint32_t n = samples(x, y);
+            if(n < 2)
+                return INF;
+            return 1.96f * std::sqrt(variance(x, y)/n)/std::max(lumMeans[y*width + x], MIN_LUMINANCE);
+        }
+
+        /// @brief Tonemaps the average of every pixel of row %y into %out, which holds %width pixels.
+        void resolve_row(size_t y, std::span<RGBA32> out, const tonemapper& op = tonemapper::standard())const
+        {
+            assert(y < size_t(height) && out.size() == size_t(width));
+            // averages of a few dozen pixels at a time, handed to the tonemapper in one batch
+            constexpr size_t CHUNK = 64;
+            color3f means[CHUNK];
+            for(size_t x = 0; x < size_t(width); x += CHUNK)
+            {
+                size_t count = std::min(CHUNK, size_t(width) - x);
+                for(size_t k = 0; k < count; ++k)
+                    means[k] = mean(x + k, y);
+                op(means, count, out.data() + x);
+            }
+        }
+        /**
+         * @brief Writes the tonemapped average of every pixel to %image, which must be the same size. The accumulated data
+         * is left untouched. renderer::resolve does the same with rows in parallel.
+         */
+        void resolve(raster_base& image, const tonemapper& op = tonemapper::standard())const
+        {
+            assert(image.width == width && image.height == height);
+            tile_span pixels = image.span();
+            for(int y = 0; y < height; ++y)
+                resolve_row(y, pixels.row(y), op);
+        }
+
+    private:
+        std::vector<color3f> sums;
+        std::vector<uint32_t> counts;
+        std::vector<float> lumMeans, lumM2s;
+    };
+}
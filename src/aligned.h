@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace AiCo
+{
+    constexpr size_t CACHE_LINE = 64;
+
+    /**
+     * @brief Allocator returning storage aligned to %alignment bytes, for data that is loaded with aligned SIMD instructions
+     * or that must not share cache lines with other data.
+     */
+    template <typename T, size_t alignment = CACHE_LINE>
+    struct aligned_allocator
+    {
+        typedef T value_type;
+
+        template <typename D>
+        struct rebind{typedef aligned_allocator<D, alignment> other;};
+
+        aligned_allocator() noexcept = default;
+        template <typename D>
+        aligned_allocator(const aligned_allocator<D, alignment>&) noexcept {}
+
+        [[nodiscard]] T* allocate(size_t n)
+        {
+            return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(alignment)));
+        }
+        void deallocate(T* ptr, size_t)noexcept
+        {
+            ::operator delete(ptr, std::align_val_t(alignment));
+        }
+
+        template <typename D>
+        bool operator==(const aligned_allocator<D, alignment>&)const noexcept{return true;}
+    };
+
+    template <typename T, size_t alignment = CACHE_LINE>
+    using aligned_vector = std::vector<T, aligned_allocator<T, alignment>>;
+}
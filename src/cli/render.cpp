@@ -0,0 +1,201 @@
+#include "format.h"
+#include "image_io.h"
+#include "metrics.h"
+#include "raster.h"
+#include "sampler.h"
+#include "timer.h"
+#include "raytracing/bvh.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/material.h"
+#include "raytracing/pipeline.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+#include "registry.h"
+#include "rng.h"
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    struct options
+    {
+        std::string scene = "spheres";
+        int width = 640, height = 360;
+        uint samplesPerPixel = 16;
+        unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
+        std::string sampler = "sobol";
+        std::string output = "render.ppm";
+    };
+
+    void usage(const char* name)
+    {
+        std::printf("usage: %s [options]\n"
+        "  --scene NAME      spheres (default) or field, 20000 small spheres\n"
+        "  --size W H        resolution, 640 360 by default\n"
+        "  --spp N           samples per pixel, 16 by default\n"
+        "  --threads N       render threads, all hardware threads by default\n"
+        "  --sampler NAME    independent, stratified, sobol (default) or bluenoise\n"
+        "  --output PATH     image to write, .ppm, .png, .pfm or .exr, render.ppm by default\n", name);
+    }
+
+    options parse(int argc, char** argv)
+    {
+        options opts;
+        for(int i = 1; i < argc; ++i)
+        {
+            auto next = [&]() -> std::string
+            {
+                if(i + 1 >= argc)
+                    throw std::invalid_argument(std::string("missing value for ") + argv[i]);
+                return argv[++i];
+            };
+            if(!std::strcmp(argv[i], "--scene"))
+                opts.scene = next();
+            else if(!std::strcmp(argv[i], "--size"))
+            {
+                opts.width = std::stoi(next());
+                opts.height = std::stoi(next());
+            }
+            else if(!std::strcmp(argv[i], "--spp"))
+                opts.samplesPerPixel = std::stoul(next());
+            else if(!std::strcmp(argv[i], "--threads"))
+                opts.threads = std::stoul(next());
+            else if(!std::strcmp(argv[i], "--sampler"))
+                opts.sampler = next();
+            else if(!std::strcmp(argv[i], "--output"))
+                opts.output = next();
+            else
+                throw std::invalid_argument(std::string("unknown option ") + argv[i]);
+        }
+        if(opts.width <= 0 || opts.height <= 0 || opts.samplesPerPixel == 0 || opts.threads == 0)
+            throw std::invalid_argument("size, spp and threads must be positive");
+        // random numbers are keyed to 16 bit pixel coordinates, see pixel_id()
+        if(size_t(opts.width) > PIXEL_ID_LIMIT || size_t(opts.height) > PIXEL_ID_LIMIT)
+            throw std::invalid_argument("width and height must be at most " + std::to_string(PIXEL_ID_LIMIT));
+        return opts;
+    }
+
+    std::unique_ptr<sampler> make_sampler(const options& opts)
+    {
+        if(opts.sampler == "independent")
+            return std::make_unique<independent_sampler>();
+        if(opts.sampler == "stratified")
+            return std::make_unique<stratified_sampler>(opts.samplesPerPixel);
+        if(opts.sampler == "sobol")
+            return std::make_unique<sobol_sampler>();
+        if(opts.sampler == "bluenoise")
+            return std::make_unique<blue_noise_sampler>();
+        throw std::invalid_argument("unknown sampler " + opts.sampler);
+    }
+
+    /// @brief The spheres of raytracing_camera_test, or a field of small random spheres for a deeper BVH.
+    std::vector<sphere> make_scene(const std::string& name, registry<material_t>& materials,
+    registry<material_t>::handle_t METAL, registry<material_t>::handle_t DIFFUSE)
+    {
+        if(name == "spheres")
+            return {sphere(0.5f, {0.0f, 0.5f, -2.5f}, materials[METAL]),
+            sphere(20.f, {0.0f, -20.5f, -2.f}, materials[DIFFUSE]),
+            sphere(1.f, {2.f, 0.0f, -4.5f}, materials[DIFFUSE]),
+            sphere(1.f, {0.f, 0.2f, -1.5f}, materials[DIFFUSE]),
+            sphere(0.5f, {0.5f, 0.5f, -3.f}, materials[DIFFUSE]),
+            sphere(0.5f, {-0.5f, 0.f, -5.f}, materials[DIFFUSE]),
+            sphere(0.1f, {1.5f, 0.3f, -1.5f}, materials[METAL])};
+        if(name == "field")
+        {
+            std::vector<sphere> balls = {sphere(20.f, {0.0f, -20.5f, -2.f}, materials[DIFFUSE])};
+            for(uint32_t i = 0; i < 20000; ++i)
+            {
+                glm::vec3 center = {counter_rand(i, 0, 0, 0) * 40.f - 20.f, counter_rand(i, 0, 0, 1) * 3.f - 0.5f,
+                -counter_rand(i, 0, 0, 2) * 40.f - 1.f};
+                balls.emplace_back(0.05f + 0.2f * counter_rand(i, 0, 0, 3), center, materials[i % 4 ? DIFFUSE : METAL]);
+            }
+            return balls;
+        }
+        throw std::invalid_argument("unknown scene " + name);
+    }
+}
+
+// Renders a built-in scene without a window and writes it to an image file.
+int main(int argc, char** argv)
+{
+    options opts;
+    std::unique_ptr<sampler> source;
+    try
+    {
+        opts = parse(argc, argv);
+        source = make_sampler(opts);
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        usage(argv[0]);
+        return 1;
+    }
+
+    registry<material_t> mat_registry;
+    auto METAL = mat_registry.add(new material_t{.scatter = metallic(),
+    .texture =[](const intersection_t&){return color3f{0.8f, 0.8f, 0.8f};}});
+    auto DIFFUSE = mat_registry.add(new material_t{.scatter = lambertian_diffuse(),
+    .texture = [](const intersection_t&){return color3f{0.5f, 0.5f, 0.5f};}});
+
+    renderer::set_thread_count(opts.threads);
+
+    micro_timer timer;
+    std::vector<sphere> balls;
+    try
+    {
+        balls = make_scene(opts.scene, mat_registry, METAL, DIFFUSE);
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::vector<const bounded_geometry*> scene;
+    for(const auto& ball : balls)
+        scene.push_back(&ball);
+    bvh sceneBVH(scene);
+    float buildMs = timer.clock().count()/1e+3f;
+
+    static_pipeline pipeline(sceneBVH, unbiased_tracer(10, {0.001f, 40.f}),
+    vFOV_camera(40.f, opts.width, opts.height, {-2.f, -2.f , -2.5f}, 0.2f, {3.f, 2.f, -1.f}));
+
+    // tiles go to the file as they finish, so the time includes writing
+    micro_timer renderTimer;
+    try
+    {
+        std::unique_ptr<image_writer> out = open_image(opts.output, opts.width, opts.height, renderer::TILE_SIZE);
+        renderer::render(*out, pipeline, opts.samplesPerPixel, source.get());
+    }
+    catch(const std::exception& e)
+    {
+        std::fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    float renderSeconds = renderTimer.clock().count()/1e+6f;
+
+    // the counters are flushed in batches, so rays are a slight undercount
+    size_t rays = 0;
+    for(const auto& depth : PATH_DEPTH_CNTR)
+        rays += depth.load(std::memory_order_relaxed);
+    const double samples = double(opts.width) * opts.height * opts.samplesPerPixel;
+
+    std::printf("%s: %zu objects, %dx%d, %u spp, %s sampler, %u threads\n", opts.scene.c_str(), balls.size(),
+    opts.width, opts.height, opts.samplesPerPixel, opts.sampler.c_str(), renderer::thread_count());
+    std::printf("build  %10.1f ms\n", buildMs);
+    std::printf("render %10.1f ms  %8.2f Msamples/s  %8.2f Mrays/s  %s\n", renderSeconds * 1e+3f,
+    samples/renderSeconds/1e+6, rays/renderSeconds/1e+6, opts.output.c_str());
+    return 0;
+}
@@ -9,4 +9,6 @@ namespace AiCo
     typedef glm::vec<4, glm::uint8> RGBA32;
     inline RGBA32 colorftoRGBA32(const color3f& color){return RGBA32(color.r * 255.999, color.g * 255.999, color.b * 255.999, 255);}
     inline RGBA32 colorftoRGBA32(const color4f& color){return RGBA32(color.r * 255.999, color.g * 255.999, color.b * 255.999, color.a * 255.999);}
+    /// @return Relative luminance of linear Rec.709 %color.
+    inline float luminance(const color3f& color){return 0.2126f * color.r + 0.7152f * color.g + 0.0722f * color.b;}
 }
@@ -0,0 +1,465 @@
+#pragma once
+
+#include "format.h"
+#include "raster.h"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cassert>
+#include <cctype>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace AiCo
+{
+    /// @brief Writes %image to %path as a binary PPM (P6), without alpha. Throws std::runtime_error if that fails.
+    inline void write_ppm(const std::string& path, raster_base& image)
+    {
+        std::FILE* file = std::fopen(path.c_str(), "wb");
+        if(file == nullptr)
+            throw std::runtime_error("Failed to open " + path);
+
+        std::fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+        tile_span pixels = image.span();
+        std::vector<uint8_t> rgb(size_t(pixels.width) * 3);
+        for(size_t y = 0; y < pixels.height; ++y)
+        {
+            std::span<RGBA32> row = pixels.row(y);
+            for(size_t x = 0; x < row.size(); ++x)
+            {
+                rgb[3*x] = row[x].r;
+                rgb[3*x + 1] = row[x].g;
+                rgb[3*x + 2] = row[x].b;
+            }
+            std::fwrite(rgb.data(), 1, rgb.size(), file);
+        }
+
+        bool failed = std::ferror(file) != 0;
+        failed |= std::fclose(file) != 0;
+        if(failed)
+            throw std::runtime_error("Failed to write " + path);
+    }
+
+    /// @brief A finished tile: its display values, with their image offsets, and the average radiance behind them.
+    struct image_tile
+    {
+        tile_span pixels;
+        /// One value per pixel, one row after the other, before exposure and tonemapping.
+        std::span<const color3f> radiance;
+    };
+
+    /**
+     * @brief Writes an image to a file one tile at a time, as tiles finish, so that no full size copy of the image is
+     * needed. Tiles are %tileSize squares on a grid from the top left corner, smaller at the right and bottom edges.
+     * write() may be called from any thread. The file is complete once finish() returns.
+     *
+     * Writers that store rows in order buffer whole rows of tiles, and expect tiles in roughly %order, scanline for them.
+     * Tiled and seekable formats take tiles in any order, and prefer a Hilbert curve like the renderer.
+     */
+    class image_writer
+    {
+    public:
+        const unsigned int width, height, tileSize;
+        const tile_order order;
+
+        image_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize, tile_order order) :
+        width(width), height(height), tileSize(tileSize), order(order), path(path), file(std::fopen(path.c_str(), "wb"))
+        {
+            assert(width > 0 && height > 0 && tileSize > 0);
+            if(file == nullptr)
+                throw std::runtime_error("Failed to open " + path);
+        }
+        image_writer(const image_writer&) = delete;
+        image_writer& operator=(const image_writer&) = delete;
+
+        void write(const image_tile& tile)
+        {
+            assert(tile.pixels.xOffset % tileSize == 0 && tile.pixels.yOffset % tileSize == 0);
+            assert(tile.pixels.width == std::min(tileSize, width - tile.pixels.xOffset));
+            assert(tile.pixels.height == std::min(tileSize, height - tile.pixels.yOffset));
+            assert(tile.radiance.size() == size_t(tile.pixels.width) * tile.pixels.height);
+            std::lock_guard<std::mutex> lock(mutex);
+            write_tile(tile);
+        }
+        /// @brief Completes and closes the file. Throws std::runtime_error if any write failed.
+        void finish()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if(file == nullptr)
+                return;
+            finish_file();
+            bool failed = std::ferror(file) != 0;
+            failed |= std::fclose(file) != 0;
+            file = nullptr;
+            if(failed)
+                throw std::runtime_error("Failed to write " + path);
+        }
+
+        virtual ~image_writer()
+        {
+            if(file != nullptr)
+                std::fclose(file);
+        }
+
+    protected:
+        std::string path;
+        std::FILE* file;
+
+        virtual void write_tile(const image_tile& tile) = 0;
+        virtual void finish_file() {}
+
+        /// @brief Writes %bytes bytes at %offset from the start of the file.
+        void write_at(uint64_t offset, const void* data, size_t bytes)
+        {
+            std::fseek(file, long(offset), SEEK_SET);
+            std::fwrite(data, 1, bytes, file);
+        }
+        template<typename T>
+        void put(const T& value){std::fwrite(&value, sizeof(T), 1, file);}
+
+    private:
+        std::mutex mutex;
+    };
+
+    /**
+     * @brief Writer for formats that store 8 bit RGB rows from top to bottom. Tiles are copied into the row of tiles they
+     * belong to, and rows of tiles are passed to write_rows() in order as soon as they and all rows above are complete.
+     */
+    class row_writer : public image_writer
+    {
+    public:
+        row_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize) :
+        image_writer(path, width, height, tileSize, tile_order::scanline) {}
+
+    protected:
+        /// @brief Writes %rows rows of %width RGB pixels, the next ones from the top.
+        virtual void write_rows(const uint8_t* rgb, size_t rows) = 0;
+
+        void write_tile(const image_tile& tile) override
+        {
+            const tile_span& pixels = tile.pixels;
+            const unsigned int index = pixels.yOffset / tileSize;
+            band& b = pending[index];
+            if(b.rgb.empty())
+                b.rgb.resize(size_t(width) * pixels.height * 3);
+
+            for(size_t y = 0; y < pixels.height; ++y)
+            {
+                std::span<RGBA32> row = pixels.row(y);
+                uint8_t* out = &b.rgb[(y * width + pixels.xOffset) * 3];
+                for(size_t x = 0; x < row.size(); ++x)
+                {
+                    out[3*x] = row[x].r;
+                    out[3*x + 1] = row[x].g;
+                    out[3*x + 2] = row[x].b;
+                }
+            }
+            b.filled += pixels.width;
+
+            for(auto it = pending.begin(); it != pending.end() && it->first == nextBand && it->second.filled == width;
+            it = pending.erase(it), ++nextBand)
+                write_rows(it->second.rgb.data(), it->second.rgb.size() / (size_t(width) * 3));
+        }
+
+        void finish_file() override
+        {
+            if(size_t(nextBand) * tileSize < height)
+                throw std::runtime_error("Missing tiles in " + path);
+        }
+
+    private:
+        struct band
+        {
+            std::vector<uint8_t> rgb;
+            /// Columns written so far.
+            unsigned int filled = 0;
+        };
+        std::map<unsigned int, band> pending;
+        unsigned int nextBand = 0;
+    };
+
+    /// @brief Binary PPM (P6), 8 bit RGB.
+    class ppm_writer : public row_writer
+    {
+    public:
+        ppm_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize) :
+        row_writer(path, width, height, tileSize)
+        {
+            std::fprintf(file, "P6\n%u %u\n255\n", width, height);
+        }
+
+    protected:
+        void write_rows(const uint8_t* rgb, size_t rows) override
+        {
+            std::fwrite(rgb, 1, rows * width * 3, file);
+        }
+    };
+
+    /**
+     * @brief 8 bit RGB PNG. Without a zlib in the tree the image data is stored in uncompressed deflate blocks, which
+     * every PNG reader accepts. Files are about as large as PPMs.
+     */
+    class png_writer : public row_writer
+    {
+    public:
+        png_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize) :
+        row_writer(path, width, height, tileSize)
+        {
+            static constexpr uint8_t SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+            std::fwrite(SIGNATURE, 1, sizeof(SIGNATURE), file);
+
+            std::vector<uint8_t> header;
+            append_be32(header, width);
+            append_be32(header, height);
+            // 8 bits per channel, truecolor, deflate, adaptive filtering, no interlacing
+            header.insert(header.end(), {8, 2, 0, 0, 0});
+            chunk("IHDR", header);
+        }
+
+    protected:
+        void write_rows(const uint8_t* rgb, size_t rows) override
+        {
+            const size_t rowBytes = size_t(width) * 3;
+            std::vector<uint8_t> data;
+            if(rowsWritten == 0)
+                data.insert(data.end(), {0x78, 0x01});  // zlib header: deflate, 32K window, no dictionary
+
+            // every row is filter type 0 and its pixels, split into stored blocks of at most 65535 bytes
+            std::vector<uint8_t> raw;
+            raw.reserve(rows * (rowBytes + 1));
+            for(size_t y = 0; y < rows; ++y)
+            {
+                raw.push_back(0);
+                raw.insert(raw.end(), rgb + y * rowBytes, rgb + (y + 1) * rowBytes);
+            }
+            rowsWritten += rows;
+            for(uint8_t byte : raw)
+            {
+                adlerA = (adlerA + byte) % 65521;
+                adlerB = (adlerB + adlerA) % 65521;
+            }
+
+            const bool last = rowsWritten == height;
+            for(size_t begin = 0; begin < raw.size(); begin += 65535)
+            {
+                uint16_t length = uint16_t(std::min<size_t>(65535, raw.size() - begin));
+                data.push_back(last && begin + length == raw.size());
+                data.insert(data.end(), {uint8_t(length), uint8_t(length >> 8), uint8_t(~length), uint8_t(~length >> 8)});
+                data.insert(data.end(), raw.begin() + begin, raw.begin() + begin + length);
+            }
+            if(last)
+                append_be32(data, (adlerB << 16) | adlerA);
+            chunk("IDAT", data);
+        }
+
+        void finish_file() override
+        {
+            row_writer::finish_file();
+            chunk("IEND", {});
+        }
+
+    private:
+        size_t rowsWritten = 0;
+        uint32_t adlerA = 1, adlerB = 0;
+
+        static void append_be32(std::vector<uint8_t>& out, uint32_t value)
+        {
+            out.insert(out.end(), {uint8_t(value >> 24), uint8_t(value >> 16), uint8_t(value >> 8), uint8_t(value)});
+        }
+        static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t n)
+        {
+            static const auto TABLE = []
+            {
+                std::array<uint32_t, 256> table;
+                for(uint32_t i = 0; i < 256; ++i)
+                {
+                    uint32_t c = i;
+                    for(int k = 0; k < 8; ++k)
+                        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                    table[i] = c;
+                }
+                return table;
+            }();
+            for(size_t i = 0; i < n; ++i)
+                crc = TABLE[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            return crc;
+        }
+        void chunk(const char type[4], const std::vector<uint8_t>& data)
+        {
+            std::vector<uint8_t> length;
+            append_be32(length, uint32_t(data.size()));
+            std::fwrite(length.data(), 1, 4, file);
+            std::fwrite(type, 1, 4, file);
+            std::fwrite(data.data(), 1, data.size(), file);
+
+            uint32_t crc = crc32(0xffffffffu, reinterpret_cast<const uint8_t*>(type), 4);
+            crc = crc32(crc, data.data(), data.size()) ^ 0xffffffffu;
+            std::vector<uint8_t> trailer;
+            append_be32(trailer, crc);
+            std::fwrite(trailer.data(), 1, 4, file);
+        }
+    };
+
+    static_assert(sizeof(color3f) == 3 * sizeof(float));
+
+    /**
+     * @brief Portable float map: linear float RGB, rows from the bottom up. Every row of a tile goes straight to its place
+     * in the file, so nothing is buffered.
+     */
+    class pfm_writer : public image_writer
+    {
+    public:
+        pfm_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize) :
+        image_writer(path, width, height, tileSize, tile_order::hilbert)
+        {
+            static_assert(std::endian::native == std::endian::little);
+            // a negative scale marks little endian data
+            headerBytes = std::fprintf(file, "PF\n%u %u\n-1.0\n", width, height);
+        }
+
+    protected:
+        void write_tile(const image_tile& tile) override
+        {
+            const tile_span& pixels = tile.pixels;
+            for(size_t y = 0; y < pixels.height; ++y)
+            {
+                uint64_t fileRow = height - 1 - (pixels.yOffset + y);
+                write_at(headerBytes + (fileRow * width + pixels.xOffset) * sizeof(color3f),
+                &tile.radiance[y * pixels.width], pixels.width * sizeof(color3f));
+            }
+        }
+
+    private:
+        uint64_t headerBytes = 0;
+    };
+
+    /**
+     * @brief Tiled OpenEXR with 32 bit float R, G and B channels and no compression: the subset every EXR reader handles.
+     * Tiles are appended as they finish, in any order (line order RANDOM_Y), and the offset table in front of them is
+     * filled in by finish().
+     */
+    class exr_writer : public image_writer
+    {
+    public:
+        exr_writer(const std::string& path, unsigned int width, unsigned int height, unsigned int tileSize) :
+        image_writer(path, width, height, tileSize, tile_order::hilbert),
+        nrCols((width + tileSize - 1)/tileSize), nrRows((height + tileSize - 1)/tileSize), offsets(size_t(nrCols) * nrRows, 0)
+        {
+            static_assert(std::endian::native == std::endian::little);
+            put(uint32_t(20000630));
+            put(uint32_t(2 | 0x200));  // version 2, tiled
+
+            attribute("channels", "chlist", 3 * 18 + 1);
+            for(char channel : {'B', 'G', 'R'})
+            {
+                std::fputc(channel, file);
+                std::fputc(0, file);
+                put(int32_t(2));  // FLOAT
+                put(uint32_t(0));  // pLinear and reserved
+                put(int32_t(1));
+                put(int32_t(1));  // x and y sampling
+            }
+            std::fputc(0, file);
+
+            attribute("compression", "compression", 1);
+            std::fputc(0, file);
+            for(const char* window : {"dataWindow", "displayWindow"})
+            {
+                attribute(window, "box2i", 16);
+                put(int32_t(0));
+                put(int32_t(0));
+                put(int32_t(width - 1));
+                put(int32_t(height - 1));
+            }
+            attribute("lineOrder", "lineOrder", 1);
+            std::fputc(2, file);  // RANDOM_Y
+            attribute("pixelAspectRatio", "float", 4);
+            put(1.f);
+            attribute("screenWindowCenter", "v2f", 8);
+            put(0.f);
+            put(0.f);
+            attribute("screenWindowWidth", "float", 4);
+            put(1.f);
+            attribute("tiles", "tiledesc", 9);
+            put(uint32_t(tileSize));
+            put(uint32_t(tileSize));
+            std::fputc(0, file);  // ONE_LEVEL, rounding down
+            std::fputc(0, file);  // end of header
+
+            tableOffset = uint64_t(std::ftell(file));
+            std::fwrite(offsets.data(), sizeof(uint64_t), offsets.size(), file);
+            end = tableOffset + offsets.size() * sizeof(uint64_t);
+        }
+
+    protected:
+        void write_tile(const image_tile& tile) override
+        {
+            const tile_span& pixels = tile.pixels;
+            const unsigned int tx = pixels.xOffset / tileSize, ty = pixels.yOffset / tileSize;
+
+            // per row, every channel's values in alphabetical order
+            chunkData.clear();
+            for(size_t y = 0; y < pixels.height; ++y)
+                for(int channel : {2, 1, 0})
+                    for(size_t x = 0; x < pixels.width; ++x)
+                        chunkData.push_back(tile.radiance[y * pixels.width + x][channel]);
+
+            std::fseek(file, long(end), SEEK_SET);
+            offsets[size_t(ty) * nrCols + tx] = end;
+            put(int32_t(tx));
+            put(int32_t(ty));
+            put(int32_t(0));
+            put(int32_t(0));  // level
+            put(int32_t(chunkData.size() * sizeof(float)));
+            std::fwrite(chunkData.data(), sizeof(float), chunkData.size(), file);
+            end += 5 * sizeof(int32_t) + chunkData.size() * sizeof(float);
+        }
+
+        void finish_file() override
+        {
+            if(std::find(offsets.begin(), offsets.end(), 0) != offsets.end())
+                throw std::runtime_error("Missing tiles in " + path);
+            write_at(tableOffset, offsets.data(), offsets.size() * sizeof(uint64_t));
+        }
+
+    private:
+        unsigned int nrCols, nrRows;
+        /// Where each tile starts, in row major tile order.
+        std::vector<uint64_t> offsets;
+        uint64_t tableOffset = 0, end = 0;
+        std::vector<float> chunkData;
+
+        void attribute(const char* name, const char* type, int32_t size)
+        {
+            std::fwrite(name, 1, std::strlen(name) + 1, file);
+            std::fwrite(type, 1, std::strlen(type) + 1, file);
+            put(size);
+        }
+    };
+
+    /// @return A writer for %path, picked by its extension: .ppm, .png, .pfm or .exr. Throws std::invalid_argument otherwise.
+    [[nodiscard]] inline std::unique_ptr<image_writer> open_image(const std::string& path, unsigned int width, unsigned int height,
+    unsigned int tileSize = 32)
+    {
+        std::string extension = path.substr(std::min(path.size(), path.rfind('.')));
+        std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c){return char(std::tolower(c));});
+        if(extension == ".ppm")
+            return std::make_unique<ppm_writer>(path, width, height, tileSize);
+        if(extension == ".png")
+            return std::make_unique<png_writer>(path, width, height, tileSize);
+        if(extension == ".pfm")
+            return std::make_unique<pfm_writer>(path, width, height, tileSize);
+        if(extension == ".exr")
+            return std::make_unique<exr_writer>(path, width, height, tileSize);
+        throw std::invalid_argument("Unknown image format " + path);
+    }
+}
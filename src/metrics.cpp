@@ -3,3 +3,6 @@
 
 thread_local size_t LOCAL_INSCT_CNTR = 0;
 std::atomic<size_t> INSCT_CNTR = 0;
+
+thread_local size_t LOCAL_PATH_DEPTH_CNTR[MAX_TRACKED_DEPTH] = {};
+std::atomic<size_t> PATH_DEPTH_CNTR[MAX_TRACKED_DEPTH] = {};
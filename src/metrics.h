@@ -1,5 +1,32 @@
+#pragma once
+
 #include <atomic>
 #include <cstddef>
 
 extern thread_local size_t LOCAL_INSCT_CNTR;
 extern std::atomic<size_t> INSCT_CNTR;
+
+constexpr size_t MAX_TRACKED_DEPTH = 32;
+extern thread_local size_t LOCAL_PATH_DEPTH_CNTR[MAX_TRACKED_DEPTH];
+/// Number of paths that reached each bounce, i.e., that were still alive when their ray at that depth was traced.
+extern std::atomic<size_t> PATH_DEPTH_CNTR[MAX_TRACKED_DEPTH];
+
+// intersection count mechanism. add thread local variable to global atomic every 2^16 intersects.
+// %n intersects at once for batched tests, e.g. a SIMD test of n primitives
+inline void count_intersect(size_t n = 1)
+{
+    size_t before = LOCAL_INSCT_CNTR;
+    LOCAL_INSCT_CNTR += n;
+    if(size_t batches = (LOCAL_INSCT_CNTR >> 16) - (before >> 16); batches != 0)
+        INSCT_CNTR.fetch_add(batches << 16, std::memory_order_relaxed);
+}
+
+// same batching for the per-depth path counters, flushed every 2^12 paths
+inline void count_path_depth(size_t depth)
+{
+    if(depth >= MAX_TRACKED_DEPTH)
+        return;
+    LOCAL_PATH_DEPTH_CNTR[depth]++;
+    if(LOCAL_PATH_DEPTH_CNTR[depth]%(1<<12) == 0)
+        PATH_DEPTH_CNTR[depth].fetch_add(1<<12, std::memory_order_relaxed);
+}
@@ -1,7 +1,21 @@
 #include <stdexcept>
-#include "SDL.h"
+#include <utility>
+#include "image_io.h"
 #include "output.h"
 
+AiCo::output::headless::headless(std::string path, uint width, uint height) : path(std::move(path)), framebuffer(width, height) {}
+void AiCo::output::headless::write_frame()
+{
+    if(!path.empty())
+        write_ppm(path, framebuffer);
+}
+
+#ifndef AICO_SDL
+void AiCo::output::init() {}
+void AiCo::output::terminate() {}
+#else
+#include "SDL.h"
+
 void AiCo::output::init()
 {
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -36,3 +50,4 @@ AiCo::output::window::~window()
     SDL_DestroyTexture(frame);
     SDL_DestroyWindow(handle);
 }
+#endif
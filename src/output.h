@@ -1,14 +1,20 @@
 #pragma once
 
+#ifdef AICO_SDL
 #include "SDL.h"
+#endif
 #include "raster.h"
 
+#include <string>
+
 namespace AiCo
 {
     namespace output
     {
+        /// @brief Sets up the window system, if built with SDL. Call before creating a window.
         void init();
         void terminate();
+#ifdef AICO_SDL
         class window
         {
             SDL_Window* handle;
@@ -20,5 +26,18 @@ namespace AiCo
             void write_frame();
             ~window();
         };
+#endif
+        /**
+         * @brief Backend for machines without a display, with the same framebuffer as window. write_frame() saves the
+         * framebuffer to %path as a PPM, overwriting the previous frame. An empty %path discards frames.
+         */
+        class headless
+        {
+            std::string path;
+    public:
+            raster framebuffer;
+            headless(std::string path, uint width, uint height);
+            void write_frame();
+        };
     };
 };
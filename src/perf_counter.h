@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace AiCo
+{
+    /**
+     * @brief Hardware event counter of the calling thread, in user space only, from Linux perf_event_open.
+     * Counts cache misses that reach memory by default. Where counters are unavailable (off Linux, with
+     * perf_event_paranoid above 2, in most containers and VMs) valid() is false and every reading is 0.
+     */
+    class perf_counter
+    {
+    public:
+        enum event
+        {
+            /// The last level cache misses the kernel reports for the generic "cache-misses" event.
+            CACHE_MISSES,
+            L1D_READ_MISSES
+        };
+
+#ifdef __linux__
+        explicit perf_counter(event e = CACHE_MISSES)
+        {
+            perf_event_attr attr{};
+            attr.size = sizeof(attr);
+            if(e == L1D_READ_MISSES)
+            {
+                attr.type = PERF_TYPE_HW_CACHE;
+                attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            }
+            else
+            {
+                attr.type = PERF_TYPE_HARDWARE;
+                attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            }
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            // pid 0 and cpu -1: the calling thread, on whichever cpu it runs
+            fd = int(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+        }
+        ~perf_counter()
+        {
+            if(fd >= 0)
+                close(fd);
+        }
+
+        /// @return Events counted since construction.
+        [[nodiscard]] uint64_t read()const
+        {
+            uint64_t count = 0;
+            if(fd < 0 || ::read(fd, &count, sizeof(count)) != sizeof(count))
+                return 0;
+            return count;
+        }
+#else
+        explicit perf_counter([[maybe_unused]]event e = CACHE_MISSES) {}
+        [[nodiscard]] uint64_t read()const{return 0;}
+#endif
+        perf_counter(const perf_counter&) = delete;
+        perf_counter& operator=(const perf_counter&) = delete;
+
+        [[nodiscard]] bool valid()const{return fd >= 0;}
+
+    private:
+        int fd = -1;
+    };
+}
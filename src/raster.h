@@ -1,16 +1,61 @@
 #pragma once
 
+#include "aligned.h"
 #include "format.h"
+#include "simd.h"
+#include <algorithm>
 #include <cassert>
 #include <cmath>
 #include <complex>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstring>
+#include <memory>
+#include <span>
+#include <utility>
 #include <vector>
 
 namespace AiCo
 {
+    /// @brief Rectangle of pixels of some image, independent of how the image stores them.
+    struct tile_rect
+    {
+        unsigned int xOffset, yOffset;
+        unsigned int width, height;
+    };
+
+    /**
+     * @brief Non-owning window of %width x %height pixels starting at %data, with rows %stride pixels apart.
+     * Unlike raster_view nothing is virtual: at() inlines to one multiply-add, and row() hands out whole rows to loop over.
+     */
+    struct tile_span
+    {
+        RGBA32* data = nullptr;
+        size_t stride = 0;
+        unsigned int width = 0, height = 0;
+        /// Where %data is in the image the span was taken from, for code that needs image coordinates.
+        unsigned int xOffset = 0, yOffset = 0;
+
+        [[nodiscard]] inline RGBA32& at(size_t x, size_t y)const
+        {
+            assert(x < width && y < height);
+            return data[y*stride + x];
+        }
+        [[nodiscard]] inline std::span<RGBA32> row(size_t y)const
+        {
+            assert(y < height);
+            return {data + y*stride, width};
+        }
+        /// @return The part of this span covered by %tile, given relative to this span.
+        [[nodiscard]] inline tile_span sub(const tile_rect& tile)const
+        {
+            assert(tile.xOffset + tile.width <= width && tile.yOffset + tile.height <= height);
+            return {data + tile.yOffset*stride + tile.xOffset, stride, tile.width, tile.height, 
+            xOffset + tile.xOffset, yOffset + tile.yOffset};
+        }
+    };
+
     class raster_base
     {
     public:
@@ -30,6 +75,11 @@ namespace AiCo
             assert(x < width && y < height);
             return data[y*width + x];
         }
+        /// @return All of the pixels, for loops that should not pay a virtual call per pixel.
+        [[nodiscard]] virtual tile_span span()
+        {
+            return {data, size_t(width), unsigned(width), unsigned(height), 0, 0};
+        }
         
         virtual ~raster_base() = 0;
     };
@@ -50,7 +100,7 @@ namespace AiCo
             if(this == &other)
                 return *this;
 
-            delete [] this->data;
+            deallocate(this->data);
             this->width = other.width; this->height = other.height;
             this->data = other.data;
 
@@ -60,9 +110,22 @@ namespace AiCo
             return *this;
         }
 
-        raster(int width, int height) : raster_base(width, height, new RGBA32[width*height]({0, 0, 0, 0})) {}
+        raster(int width, int height) : raster_base(width, height, allocate(size_t(width)*height)) {}
+
+        ~raster() noexcept override {deallocate(data);}
 
-        ~raster() noexcept override {delete [] data;}
+    private:
+        /// Cache line aligned, so tiles whose x offset is a multiple of 16 pixels share no lines with their neighbours.
+        [[nodiscard]] static RGBA32* allocate(size_t count)
+        {
+            RGBA32* pixels = aligned_allocator<RGBA32>().allocate(count);
+            std::uninitialized_fill_n(pixels, count, RGBA32(0, 0, 0, 0));
+            return pixels;
+        }
+        static void deallocate(RGBA32* pixels) noexcept
+        {
+            aligned_allocator<RGBA32>().deallocate(pixels, 0);
+        }
     };
 
     class raster_view : public raster_base
@@ -86,29 +149,182 @@ namespace AiCo
             assert(x < width && y < height);
             return parent->at(x + xOffset, y + yOffset);
         }
+        /// @return The pixels of the view, in the memory of the image it is a view of.
+        [[nodiscard]] tile_span span() override
+        {
+            return parent->span().sub({xOffset, yOffset, unsigned(width), unsigned(height)});
+        }
 
         ~raster_view() noexcept override {}
     };
-    [[nodiscard]] inline std::vector<raster_view> tile_raster (raster_base* img, unsigned int nrRows, unsigned nrCols) noexcept
+
+    /// @brief Splits a %width x %height image into %nrRows x %nrCols tiles. The last row and column absorb the remainder.
+    [[nodiscard]] inline std::vector<tile_rect> tile_rects(unsigned int width, unsigned int height, unsigned int nrRows, unsigned nrCols) noexcept
     {
         unsigned int count = nrCols * nrRows;
         
         assert(count != 0);
 
-        std::vector<raster_view> tiles;
+        std::vector<tile_rect> tiles;
         tiles.reserve(count);
 
-        unsigned int tileWidth = img->width/nrCols, tileHeight = img->height/nrRows;
+        unsigned int tileWidth = width/nrCols, tileHeight = height/nrRows;
         for (size_t i = 0; i < nrRows; ++i)
             for (size_t j = 0; j <  nrCols; ++j)
             {
                 unsigned int xOffset = tileWidth * j, yOffset = tileHeight * i;
 
-                unsigned int realWidth = j == nrCols - 1 ? img->width - xOffset : tileWidth;
-                unsigned int realHeight = i == nrRows - 1 ? img->height - yOffset : tileHeight;
+                unsigned int realWidth = j == nrCols - 1 ? width - xOffset : tileWidth;
+                unsigned int realHeight = i == nrRows - 1 ? height - yOffset : tileHeight;
+
+                tiles.push_back({xOffset, yOffset, realWidth, realHeight});
+            }
+        return tiles;
+    }
+
+    /// @return Morton (Z-order) index of (%x, %y): the bits of x and y interleaved, x in the even bits.
+    [[nodiscard]] constexpr uint32_t morton_index(uint32_t x, uint32_t y)
+    {
+        auto spread = [](uint32_t v)
+        {
+            v &= 0xffffu;
+            v = (v | (v << 8)) & 0x00ff00ffu;
+            v = (v | (v << 4)) & 0x0f0f0f0fu;
+            v = (v | (v << 2)) & 0x33333333u;
+            v = (v | (v << 1)) & 0x55555555u;
+            return v;
+        };
+        return spread(x) | (spread(y) << 1);
+    }
+    /**
+     * @return Distance of (%x, %y) along the Hilbert curve through a %side x %side grid, %side a power of two.
+     * Consecutive distances are always neighbouring cells, unlike Morton indices which jump at every quadrant.
+     */
+    [[nodiscard]] constexpr uint32_t hilbert_index(uint32_t side, uint32_t x, uint32_t y)
+    {
+        uint32_t d = 0;
+        for(uint32_t s = side/2; s > 0; s /= 2)
+        {
+            uint32_t rx = (x & s) > 0, ry = (y & s) > 0;
+            d += s * s * ((3 * rx) ^ ry);
+            // rotate the quadrant so the sub-curve starts and ends where its neighbours expect
+            if(ry == 0)
+            {
+                if(rx == 1)
+                {
+                    x = side - 1 - x;
+                    y = side - 1 - y;
+                }
+                std::swap(x, y);
+            }
+        }
+        return d;
+    }
+
+    enum class tile_order{scanline, morton, hilbert};
+
+    /**
+     * @brief Splits a %width x %height image into %tileSize x %tileSize tiles, listed in %order. The last row and column
+     * hold the remainder. Along a Morton or Hilbert curve, tiles that are close in the list are close in the image.
+     */
+    [[nodiscard]] inline std::vector<tile_rect> square_tiles(unsigned int width, unsigned int height, unsigned int tileSize,
+    tile_order order = tile_order::hilbert)
+    {
+        assert(tileSize != 0);
+        const unsigned int nrCols = std::max(1u, (width + tileSize - 1)/tileSize);
+        const unsigned int nrRows = std::max(1u, (height + tileSize - 1)/tileSize);
+
+        uint32_t side = 1;
+        while(side < std::max(nrCols, nrRows))
+            side *= 2;
+
+        std::vector<std::pair<uint32_t, tile_rect>> keyed;
+        keyed.reserve(size_t(nrRows) * nrCols);
+        for(unsigned int i = 0; i < nrRows; ++i)
+            for(unsigned int j = 0; j < nrCols; ++j)
+            {
+                uint32_t key = order == tile_order::hilbert ? hilbert_index(side, j, i) :
+                order == tile_order::morton ? morton_index(j, i) : i * nrCols + j;
 
-                tiles.push_back(raster_view(realWidth, realHeight, xOffset, yOffset, img));
+                unsigned int xOffset = j * tileSize, yOffset = i * tileSize;
+                keyed.push_back({key, {xOffset, yOffset, std::min(tileSize, width - xOffset), std::min(tileSize, height - yOffset)}});
             }
+        std::sort(keyed.begin(), keyed.end(), [](const auto& a, const auto& b){return a.first < b.first;});
+
+        std::vector<tile_rect> tiles;
+        tiles.reserve(keyed.size());
+        for(const auto& [key, tile] : keyed)
+            tiles.push_back(tile);
+        return tiles;
+    }
+
+    /**
+     * @brief Where a worker renders a tile before publishing it to the image in one go. Rows start on cache lines of
+     * their own, so no other worker writes to the lines while the tile is rendered, and publish() streams the finished
+     * rows out without reading the image's lines into cache. Storage is reused from tile to tile, use one per thread.
+     */
+    class tile_buffer
+    {
+    public:
+        /// @return The buffer of the calling thread.
+        [[nodiscard]] static tile_buffer& local()
+        {
+            static thread_local tile_buffer buffer;
+            return buffer;
+        }
+
+        /// @return Local pixels standing in for %target, with its size and image offsets. Ends the previous tile.
+        [[nodiscard]] tile_span begin(const tile_span& target)
+        {
+            this->target = target;
+            stride = (target.width + LINE_PIXELS - 1)/LINE_PIXELS * LINE_PIXELS;
+            if(pixels.size() < stride * target.height)
+                pixels.resize(stride * target.height);
+            if(sums.size() < size_t(target.width) * target.height)
+                sums.resize(size_t(target.width) * target.height);
+            return {pixels.data(), stride, target.width, target.height, target.xOffset, target.yOffset};
+        }
+        /// @return Local pixels for %rect of an image that is not held anywhere, such as one streamed to an image_writer.
+        [[nodiscard]] tile_span begin(const tile_rect& rect)
+        {
+            return begin(tile_span{nullptr, 0, rect.width, rect.height, rect.xOffset, rect.yOffset});
+        }
+        /// @return Float storage for the current tile, one value per pixel in row order, for summing samples. Not cleared.
+        [[nodiscard]] std::span<color3f> radiance()
+        {
+            return {sums.data(), size_t(target.width) * target.height};
+        }
+        /// @brief Copies the current tile's pixels to the target passed to begin().
+        void publish()const
+        {
+            assert(target.data != nullptr);
+            for(size_t y = 0; y < target.height; ++y)
+                simd::stream_copy(target.row(y).data(), pixels.data() + y * stride, target.width * sizeof(RGBA32));
+            simd::stream_fence();
+        }
+
+    private:
+        static constexpr size_t LINE_PIXELS = CACHE_LINE/sizeof(RGBA32);
+
+        aligned_vector<RGBA32> pixels;
+        aligned_vector<color3f> sums;
+        tile_span target;
+        size_t stride = 0;
+    };
+
+    [[nodiscard]] inline tile_span span_of(raster_base& img, const tile_rect& tile)
+    {
+        return img.span().sub(tile);
+    }
+    [[nodiscard]] inline raster_view view_of(raster_base* img, const tile_rect& tile) noexcept
+    {
+        return raster_view(tile.width, tile.height, tile.xOffset, tile.yOffset, img);
+    }
+    [[nodiscard]] inline std::vector<raster_view> tile_raster (raster_base* img, unsigned int nrRows, unsigned nrCols) noexcept
+    {
+        std::vector<raster_view> tiles;
+        for(const auto& tile : tile_rects(img->width, img->height, nrRows, nrCols))
+            tiles.push_back(view_of(img, tile));
         return tiles;
     }
 };
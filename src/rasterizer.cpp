@@ -3,14 +3,19 @@
 #include "glm/glm.hpp"
 #include "output.h"
 #include <algorithm>
+#include <bit>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <limits>
+#include <span>
 #include <sys/types.h>
-#include <tuple>
+#include <type_traits>
 #include <utility>
 #include "rasterizer.h"
+#include "simd.h"
+#include "threadpool.h"
 
 AiCo::rasterizer::rasterizer(uint rasterWidth, uint rasterHeight, glm::vec2 worldX, glm::vec2 worldY, glm::vec2 worldZ, RGBA32* rasterPtr) 
 : raster(rasterPtr == nullptr ? new RGBA32[rasterWidth * rasterHeight] : rasterPtr), rasterWidth(rasterWidth), rasterHeight(rasterHeight), 
@@ -19,6 +24,16 @@ ownsRaster(rasterPtr == nullptr ? true : false)
     if(ownsRaster)
         std::fill(raster, raster + rasterHeight*rasterWidth, RGBA32{255, 255, 255, 255});
 
+    static_assert(BIN_SIZE % BLOCK_SIZE == 0);
+    blockCols = (rasterWidth + BLOCK_SIZE - 1)/BLOCK_SIZE;
+    blockRows = (rasterHeight + BLOCK_SIZE - 1)/BLOCK_SIZE;
+    tileCols = (rasterWidth + BIN_SIZE - 1)/BIN_SIZE;
+    depth.resize(size_t(rasterWidth) * rasterHeight);
+    blockNear.resize(size_t(blockCols) * blockRows);
+    blockFar.resize(blockNear.size());
+    tileFar.resize(size_t(tileCols) * ((rasterHeight + BIN_SIZE - 1)/BIN_SIZE));
+    clear_depth();
+
     glm::vec4 col4(float(rasterWidth - 1)/2.f, float(rasterHeight - 1)/2.f, 0.f, 1.f);
     glm::vec4 col3(0.f, 0.f, 1.f, 0.f);
     glm::vec4 col2(0.f, float(rasterHeight)/2.f, 0.f, 0.f);
@@ -48,6 +63,7 @@ ownsRaster(rasterPtr == nullptr ? true : false)
     projectionTransform = glm::mat4(col1, col2, col3, col4);
 
     cameraTransform = glm::mat4(1);
+    worldToSCR = canonicalToSCR*volumeToCanonical*projectionTransform*cameraTransform;
 }
 void AiCo::rasterizer::set_camera_transform(glm::vec3 origin, glm::vec3 view, glm::vec3 up)
 {
@@ -64,6 +80,7 @@ void AiCo::rasterizer::set_camera_transform(glm::vec3 origin, glm::vec3 view, gl
     glm::vec4 col1(u.x, v.x, w.x, 0.f);
 
     cameraTransform = glm::mat4(col1, col2, col3, col4);
+    worldToSCR = canonicalToSCR*volumeToCanonical*projectionTransform*cameraTransform;
 }
 inline glm::vec3 homogenize(glm::vec4 u)
 {
@@ -75,121 +92,701 @@ inline void AiCo::rasterizer::draw_point(glm::vec3 worldCoords, RGBA32 color)
 {
     glm::vec4 homogCoords(worldCoords, 1.f);
     glm::vec3 screenCoords = homogenize(canonicalToSCR * volumeToCanonical * homogCoords);
-    raster[(uint)screenCoords.y*rasterWidth + (uint)screenCoords.x] = color;
+    span().at((uint)screenCoords.x, (uint)screenCoords.y) = color;
 }
 
 void AiCo::rasterizer::sample_raster(uint sampleHeight, uint sampleWidth, RGBA32* result)
 {    
+    tile_span pixels = span();
     for(size_t i = 0; i < sampleHeight; ++i)
+    {
+        // every sample of a row reads from the same raster row
+        constexpr float halfPixel = 0.5f;
+        float vCenter = float(i + halfPixel)/sampleHeight; // [0, 1] vertical pixel center
+        std::span<const RGBA32> rasterRow = pixels.row(uint(vCenter * rasterHeight));
+        RGBA32* resultRow = result + i*sampleWidth;
+
         for(size_t j = 0; j < sampleWidth; ++j)
         {
             // sample pixel centers from raster
-            constexpr float halfPixel = 0.5f;
-            float vCenter = float(i + halfPixel)/sampleHeight; // [0, 1] vertical pixel center
             float hCenter = float(j + halfPixel)/sampleWidth; // [0, 1] horizontal pixel center
-            
-            uint vRasterPixel = uint(vCenter * rasterHeight);
-            uint hRasterPixel = uint(hCenter * rasterWidth);
+            resultRow[j] = rasterRow[uint(hCenter * rasterWidth)];
+        }
+    }
+}
+
+namespace
+{
+    constexpr int NR_CLIP_PLANES = 5;
+
+    /**
+     * @return Signed distances of %h, in screen coordinates before the perspective divide, from the planes geometry is
+     * clipped to, positive inside: the near plane (z/w >= -1) and the four sides of the guard band (|x/w|, |y/w| <= %band).
+     * Inside all of them w is positive.
+     */
+    template<typename T>
+    void clip_distances(const glm::vec<4, T>& h, T band, T (&distances)[NR_CLIP_PLANES])
+    {
+        distances[0] = h.z + h.w;
+        distances[1] = band * h.w - h.x;
+        distances[2] = band * h.w + h.x;
+        distances[3] = band * h.w - h.y;
+        distances[4] = band * h.w + h.y;
+    }
+    template<typename T>
+    [[nodiscard]] bool finite(const glm::vec<4, T>& h)
+    {
+        return std::isfinite(h.x) && std::isfinite(h.y) && std::isfinite(h.z) && std::isfinite(h.w);
+    }
+    /// @return Pixel coordinates of %h after the perspective divide, truncated as by toSCR(), kept in the guard band.
+    template<typename T>
+    [[nodiscard]] glm::vec<2, int> to_screen(const glm::vec<4, T>& h)
+    {
+        constexpr T BAND = T(AiCo::rasterizer::GUARD_BAND);
+        return {int(std::clamp(h.x / h.w, -BAND, BAND)), int(std::clamp(h.y / h.w, -BAND, BAND))};
+    }
 
-            result[i*sampleWidth + j] = raster[vRasterPixel*rasterWidth + hRasterPixel];
+    /// @brief Liang-Barsky: shortens the segment from %a to %b to its part inside every clip plane. @return false if none is.
+    template<typename T>
+    [[nodiscard]] bool clip_segment(glm::vec<4, T>& a, glm::vec<4, T>& b, T band)
+    {
+        if(!finite(a) || !finite(b))
+            return false;
+        T da[NR_CLIP_PLANES], db[NR_CLIP_PLANES];
+        clip_distances(a, band, da);
+        clip_distances(b, band, db);
+        T t0 = 0, t1 = 1;
+        for(int plane = 0; plane < NR_CLIP_PLANES; ++plane)
+        {
+            if(da[plane] < 0 && db[plane] < 0)
+                return false;
+            if(da[plane] < 0)
+                t0 = std::max(t0, da[plane] / (da[plane] - db[plane]));
+            else if(db[plane] < 0)
+                t1 = std::min(t1, da[plane] / (da[plane] - db[plane]));
         }
+        if(t0 > t1)
+            return false;
+        const glm::vec<4, T> start = a, direction = b - a;
+        a = start + t0 * direction;
+        b = start + t1 * direction;
+        return true;
+    }
+
+    /// @brief Corner of a polygon being clipped, in screen coordinates before the perspective divide, and its color.
+    template<typename T>
+    struct clip_vertex
+    {
+        glm::vec<4, T> position;
+        glm::vec3 color;
+    };
+    /// A triangle gains at most a corner per plane. Twice that leaves room for slivers that rounding makes non-convex.
+    constexpr int MAX_CLIPPED = 3 + 2 * NR_CLIP_PLANES;
+
+    /**
+     * @brief Sutherland-Hodgman: clips the polygon of the first %count corners of %polygon to every clip plane, in place.
+     * Colors are interpolated along the cut edges before the divide, so the new corners get the color seen there.
+     * @return The number of corners left, less than 3 if nothing is.
+     */
+    template<typename T>
+    [[nodiscard]] int clip_polygon(clip_vertex<T> (&polygon)[MAX_CLIPPED], int count, T band)
+    {
+        for(int i = 0; i < count; ++i)
+            if(!finite(polygon[i].position))
+                return 0;
+        for(int plane = 0; plane < NR_CLIP_PLANES && count >= 3; ++plane)
+        {
+            clip_vertex<T> corners[MAX_CLIPPED];
+            T distances[MAX_CLIPPED];
+            for(int i = 0; i < count; ++i)
+            {
+                T all[NR_CLIP_PLANES];
+                clip_distances(polygon[i].position, band, all);
+                corners[i] = polygon[i];
+                distances[i] = all[plane];
+            }
+            int kept = 0;
+            for(int i = 0; i < count && kept + 2 <= MAX_CLIPPED; ++i)
+            {
+                const int next = (i + 1) % count;
+                if(distances[i] >= 0)
+                    polygon[kept++] = corners[i];
+                if((distances[i] >= 0) != (distances[next] >= 0))
+                {
+                    const T t = distances[i] / (distances[i] - distances[next]);
+                    polygon[kept++] = {corners[i].position + t * (corners[next].position - corners[i].position),
+                    corners[i].color + float(t) * (corners[next].color - corners[i].color)};
+                }
+            }
+            count = kept;
+        }
+        return count;
+    }
 }
 
-glm::vec<2, int> AiCo::rasterizer::toSCR(glm::vec3 u){return homogenize(canonicalToSCR*volumeToCanonical*projectionTransform*cameraTransform*glm::vec4(u, 1.f));}
+glm::vec<2, int> AiCo::rasterizer::toSCR(glm::vec3 u){return homogenize(worldToSCR*glm::vec4(u, 1.f));}
 
-void AiCo::rasterizer::draw_line_midpoint_world(glm::vec3 worldP1, glm::vec3 worldP2, RGBA32 color)
+void AiCo::rasterizer::transform_points(std::span<const glm::vec3> in, std::span<glm::vec<2, int>> out)const
 {
-    glm::mat4 WtoSCR = canonicalToSCR*volumeToCanonical*projectionTransform*cameraTransform;
+    using namespace simd;
+    assert(in.size() == out.size());
 
-    glm::vec<2, uint> p1(homogenize(WtoSCR * glm::vec4(worldP1, 1.f)));
-    glm::vec<2, uint> p2(homogenize(WtoSCR * glm::vec4(worldP2, 1.f)));
+    // rows x, y and w of the matrix, one lane-wide copy per entry. The third row is not needed for a point on screen
+    vfloat m[3][4];
+    for(int col = 0; col < 4; ++col)
+    {
+        m[0][col] = set1(worldToSCR[col][0]);
+        m[1][col] = set1(worldToSCR[col][1]);
+        m[2][col] = set1(worldToSCR[col][3]);
+    }
+    size_t i = 0;
+    for(; i + WIDTH <= in.size(); i += WIDTH)
+    {
+        alignas(64) float xs[WIDTH], ys[WIDTH], zs[WIDTH];
+        for(size_t lane = 0; lane < WIDTH; ++lane)
+        {
+            xs[lane] = in[i + lane].x;
+            ys[lane] = in[i + lane].y;
+            zs[lane] = in[i + lane].z;
+        }
+        const vfloat x = load(xs), y = load(ys), z = load(zs);
+        vfloat row[3];
+        for(int r = 0; r < 3; ++r)
+            row[r] = fmadd(m[r][0], x, fmadd(m[r][1], y, fmadd(m[r][2], z, m[r][3])));
 
-    draw_line_midpoint_scr(p1,  p2, color);
+        alignas(64) int32_t screenX[WIDTH], screenY[WIDTH];
+        storeu(screenX, to_int(row[0] / row[2]));
+        storeu(screenY, to_int(row[1] / row[2]));
+        for(size_t lane = 0; lane < WIDTH; ++lane)
+            out[i + lane] = {screenX[lane], screenY[lane]};
+    }
+    for(; i < in.size(); ++i)
+        out[i] = glm::vec<2, int>(homogenize(worldToSCR*glm::vec4(in[i], 1.f)));
+}
+
+void AiCo::rasterizer::draw_line_midpoint_world(glm::vec3 worldP1, glm::vec3 worldP2, RGBA32 color)
+{
+    // cut before the divide, which would flip the part behind the camera onto the screen
+    glm::vec4 p1 = worldToSCR * glm::vec4(worldP1, 1.f), p2 = worldToSCR * glm::vec4(worldP2, 1.f);
+    if(!clip_segment(p1, p2, float(GUARD_BAND)))
+        return;
+
+    draw_line_midpoint_scr(to_screen(p1), to_screen(p2), color);
+}
+void AiCo::rasterizer::clear(RGBA32 color)
+{
+    // depth first, so the pixels are the ones left in cache for drawing
+    clear_depth();
+    std::fill(raster, raster + rasterHeight*rasterWidth, color);
+}
+void AiCo::rasterizer::clear_depth()
+{
+    // nothing drawn yet is infinitely far
+    constexpr float FAR = std::numeric_limits<float>::infinity();
+    std::fill(depth.begin(), depth.end(), FAR);
+    std::fill(blockNear.begin(), blockNear.end(), FAR);
+    std::fill(blockFar.begin(), blockFar.end(), FAR);
+    std::fill(tileFar.begin(), tileFar.end(), FAR);
 }
-void AiCo::rasterizer::clear(RGBA32 color){ std::fill(raster, raster + rasterHeight*rasterWidth, color); }
 
 void AiCo::rasterizer::draw_line_midpoint_scr(glm::vec<2, int> P1, glm::vec<2, int> P2, RGBA32 color = {255, 255, 255, 255})
 {   
-    int dx = std::abs(P2.x - P1.x), dy = std::abs(P2.y - P1.y);
+    // ends far off the screen are first brought in to the guard band, which keeps the arithmetic below in range
+    auto in_band = [](glm::vec<2, int> p){return std::abs(int64_t(p.x)) <= GUARD_BAND && std::abs(int64_t(p.y)) <= GUARD_BAND;};
+    if(!in_band(P1) || !in_band(P2))
+    {
+        glm::dvec4 p1(P1.x, P1.y, 0.0, 1.0), p2(P2.x, P2.y, 0.0, 1.0);
+        if(!clip_segment(p1, p2, double(GUARD_BAND)))
+            return;
+        P1 = to_screen(p1);
+        P2 = to_screen(p2);
+    }
+
+    int64_t dx = std::abs(int64_t(P2.x) - P1.x), dy = std::abs(int64_t(P2.y) - P1.y);
     
     bool steep = dy > dx;
 
     if(steep)
         std::swap(dy, dx);
 
-    short int xStep = 1, yStep = 1;
-    if(P1.x > P2.x)
-        xStep = -1;
-    if(P1.y > P2.y)
-        yStep = -1;
-        
-    int D = 2 * dy - dx;
-    int delatDprimary = 2 * dy;
-    int deltaDsecondary = 2 * (dy - dx);
-
-    uint x = P1.x;
-    uint y = P1.y;
-    
-    // draw first point
-    raster[y*rasterWidth + x] = color;
-   
-    for(size_t i = 0; i < dx; ++i)
+    // step i draws primary coordinate p0 + pStep * i and secondary q0 + qStep * k(i), where k(i) = (2dy*i + dx - 1)/(2dx)
+    // is how often the secondary one has moved so far
+    const int64_t p0 = steep ? P1.y : P1.x, q0 = steep ? P1.x : P1.y;
+    const int64_t pStep = (steep ? P1.y > P2.y : P1.x > P2.x) ? -1 : 1, qStep = (steep ? P1.x > P2.x : P1.y > P2.y) ? -1 : 1;
+    const int64_t pSize = steep ? rasterHeight : rasterWidth, qSize = steep ? rasterWidth : rasterHeight;
+
+    // Liang-Barsky on the step index rather than on the line, so that the visible steps draw the same pixels they would
+    // as part of the whole line. %values_inside gives the range of n with 0 <= start + step * n < size
+    auto values_inside = [](int64_t start, int64_t step, int64_t size)
+    {
+        return step > 0 ? std::pair<int64_t, int64_t>(-start, size - 1 - start) : std::pair<int64_t, int64_t>(start - size + 1, start);
+    };
+    auto [first, last] = values_inside(p0, pStep, pSize);
+    first = std::max<int64_t>(first, 0);
+    last = std::min(last, dx);
+    const auto [kFirst, kLast] = values_inside(q0, qStep, qSize);
+    if(dy == 0)
+    {
+        if(kFirst > 0 || kLast < 0)
+            return;
+    }
+    else
+    {
+        // the first step with k(i) >= kFirst and the last with k(i) <= kLast
+        if(kFirst > 0)
+            first = std::max(first, (2 * dx * kFirst - dx + 2 * dy) / (2 * dy));
+        last = kLast < 0 ? -1 : std::min(last, (2 * dx * (kLast + 1) - dx) / (2 * dy));
+    }
+    if(first > last)
+        return;
+
+    const int64_t k = dx == 0 ? 0 : (2 * dy * first + dx - 1) / (2 * dx);
+    int64_t D = 2 * dy * (first + 1) - dx * (2 * k + 1);
+    const int64_t delatDprimary = 2 * dy;
+    const int64_t deltaDsecondary = 2 * (dy - dx);
+
+    // every pixel from here to %last is on the screen, so the steps are pointer offsets
+    tile_span pixels = span();
+    const int64_t p = p0 + pStep * first, q = q0 + qStep * k;
+    RGBA32* pixel = steep ? &pixels.at(q, p) : &pixels.at(p, q);
+    const ptrdiff_t primaryOffset = steep ? pStep * ptrdiff_t(pixels.stride) : pStep;
+    const ptrdiff_t secondaryOffset = steep ? qStep : qStep * ptrdiff_t(pixels.stride);
+    for(int64_t i = first;; ++i)
     {
+        *pixel = color;
+        if(i == last)
+            break;
         if(D > 0)
         {
-            if(steep)
-                x += xStep;
-            else
-                y +=yStep;
+            pixel += secondaryOffset;
             D += deltaDsecondary;
         }
         else
             D += delatDprimary;
-        if(steep)
-            y += yStep;
-        else
-            x += xStep;
-        if(y < rasterHeight && x < rasterWidth) 
-            raster[y*rasterWidth + x] = color;
+        pixel += primaryOffset;
     }
 }
 void AiCo::rasterizer::RGB_test()
 {
+    tile_span pixels = span();
     for (size_t i = 0; i < rasterHeight; ++i)
+    {
+        std::span<RGBA32> row = pixels.row(i);
         for (size_t j = 0; j < rasterWidth; ++j)
+            row[j] = {uint8_t(255 * (float(i)/rasterHeight)), 0, uint8_t(255 * (float(j)/rasterWidth)), 0};
+    }
+}
+namespace
+{
+    /**
+     * @brief Edge function of the edge from %v0 to %v1, evaluated at pixel centers. Coordinates are doubled so that
+     * centers land on integers and the values are exact: twice the signed area of v0, v1 and the center, positive inside
+     * a triangle that is clockwise on screen (y pointing down).
+     */
+    struct edge
+    {
+        int64_t stepX, stepY;
+        /// Value at the center of pixel (0, 0).
+        int64_t origin;
+        /// What the top left rule took off the values, 0 or 1.
+        int bias = 0;
+
+        edge(glm::vec<2, int> v0, glm::vec<2, int> v1) : stepX(-2 * int64_t(v1.y - v0.y)), stepY(2 * int64_t(v1.x - v0.x))
+        {
+            int64_t dx = v1.x - v0.x, dy = v1.y - v0.y;
+            origin = dx * (1 - 2 * int64_t(v0.y)) - dy * (1 - 2 * int64_t(v0.x));
+            // top left rule: centers exactly on an edge belong to the triangle only if it is a top or a left edge, so
+            // triangles sharing an edge draw it once. Moving the other edges in by one leaves >= 0 as the inside test
+            bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+            bias = !topLeft;
+            origin -= bias;
+        }
+
+        [[nodiscard]] int64_t at(int x, int y)const{return origin + stepX * x + stepY * y;}
+        /// @return The largest value over the centers of %width x %height pixels from (x, y). Negative if all are outside.
+        [[nodiscard]] int64_t max_over(int x, int y, int width, int height)const
+        {
+            return at(x, y) + std::max<int64_t>(0, stepX * (width - 1)) + std::max<int64_t>(0, stepY * (height - 1));
+        }
+        /// @return The smallest value over the same centers. Not negative if all are inside.
+        [[nodiscard]] int64_t min_over(int x, int y, int width, int height)const
         {
-            RGBA32 C = {uint8_t(255 * (float(i)/rasterHeight)), 0, uint8_t(255 * (float(j)/rasterWidth)), 0};
-            this->raster[i*rasterWidth + j] = C;
+            return at(x, y) + std::min<int64_t>(0, stepX * (width - 1)) + std::min<int64_t>(0, stepY * (height - 1));
         }
+    };
 }
-inline std::tuple<float, float, float> get_barycentric_coords(glm::vec2 a, glm::vec2 b, glm::vec2 c, glm::vec2 P)
+
+void AiCo::rasterizer::draw_triangle_scr(glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, glm::vec<3, glm::vec3> per_vertex_color)
 {
-    float alpha = ((b.y - c.y)*P.x + (c.x - b.x)*P.y + b.x*c.y - c.x*b.y)/((b.y - c.y)*a.x + (c.x - b.x)*a.y + b.x*c.y - c.x*b.y);
-    float beta  = ((c.y - a.y)*P.x + (a.x - c.x)*P.y + a.y*c.x - c.y*a.x)/((c.y - a.y)*b.x + (a.x - c.x)*b.y + a.y*c.x - c.y*a.x);
-    float gamma = ((a.y - b.y)*P.x + (b.x - a.x)*P.y + a.x*b.y - a.y*b.x)/((a.y - b.y)*c.x + (b.x - a.x)*c.y + a.x*b.y - a.y*b.x);
-    return std::make_tuple(alpha, beta, gamma);
+    const tile_rect screen = {0, 0, rasterWidth, rasterHeight};
+    auto in_band = [](glm::vec<2, int> p){return std::abs(int64_t(p.x)) <= GUARD_BAND && std::abs(int64_t(p.y)) <= GUARD_BAND;};
+    if(in_band(a) && in_band(b) && in_band(c))
+    {
+        fill_triangle(a, b, c, per_vertex_color, screen);
+        return;
+    }
+
+    // cut down to the guard band and drawn as a fan. In doubles, corners this far out would move the cuts in floats
+    clip_vertex<double> polygon[MAX_CLIPPED] = {{glm::dvec4(a.x, a.y, 0.0, 1.0), per_vertex_color[0]},
+    {glm::dvec4(b.x, b.y, 0.0, 1.0), per_vertex_color[1]}, {glm::dvec4(c.x, c.y, 0.0, 1.0), per_vertex_color[2]}};
+    const int count = clip_polygon(polygon, 3, double(GUARD_BAND));
+    for(int i = 1; i + 1 < count; ++i)
+        fill_triangle(to_screen(polygon[0].position), to_screen(polygon[i].position), to_screen(polygon[i + 1].position),
+        {polygon[0].color, polygon[i].color, polygon[i + 1].color}, screen);
 }
-void AiCo::rasterizer::draw_triangle_scr(glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, glm::vec<3, glm::vec3> per_vertex_color)
+void AiCo::rasterizer::fill_triangle(glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, glm::vec<3, glm::vec3> per_vertex_color,
+const tile_rect& clip, const glm::vec3* vertexDepths)
 {
-    int xMin = std::min(std::min(a.x, b.x), c.x);
-    int xMax = std::max(std::max(a.x, b.x), c.x);
-    int yMin = std::min(std::min(a.y, b.y), c.y);
-    int yMax = std::max(std::max(a.y, b.y), c.y);
+    using namespace simd;
+    assert(std::abs(a.x) <= GUARD_BAND && std::abs(a.y) <= GUARD_BAND && std::abs(b.x) <= GUARD_BAND && 
+    std::abs(b.y) <= GUARD_BAND && std::abs(c.x) <= GUARD_BAND && std::abs(c.y) <= GUARD_BAND);
+    const bool depthTest = vertexDepths != nullptr;
+    glm::vec3 z = depthTest ? *vertexDepths : glm::vec3(0.f);
+
+    // clockwise, so that every edge function is positive inside. Nothing to draw for degenerate triangles
+    int64_t area = int64_t(b.x - a.x) * (c.y - a.y) - int64_t(b.y - a.y) * (c.x - a.x);
+    if(area == 0)
+        return;
+    if(area < 0)
+    {
+        std::swap(b, c);
+        std::swap(per_vertex_color[1], per_vertex_color[2]);
+        std::swap(z[1], z[2]);
+        area = -area;
+    }
+    // the edge opposite each vertex, its value over the doubled area is the vertex's barycentric coordinate
+    const edge edges[3] = {edge(b, c), edge(c, a), edge(a, b)};
 
-    for(size_t x = xMin; x < xMax; ++x)
-        for(size_t y = yMin; y < yMax; ++y)
+    // bounding box clipped to %clip, so every row of it can be written without checks
+    assert(clip.xOffset + clip.width <= rasterWidth && clip.yOffset + clip.height <= rasterHeight);
+    int xMin = std::max(std::min(std::min(a.x, b.x), c.x), int(clip.xOffset));
+    int xMax = std::min(std::max(std::max(a.x, b.x), c.x), int(clip.xOffset + clip.width));
+    int yMin = std::max(std::min(std::min(a.y, b.y), c.y), int(clip.yOffset));
+    int yMax = std::min(std::max(std::max(a.y, b.y), c.y), int(clip.yOffset + clip.height));
+    if(xMin >= xMax || yMin >= yMax)
+        return;
+
+    // hidden as a whole if its nearest corner is behind the farthest depth of every tile it overlaps
+    const float zNear = std::min({z[0], z[1], z[2]}), zFar = std::max({z[0], z[1], z[2]});
+    const int tileX0 = xMin/BIN_SIZE, tileX1 = (xMax - 1)/BIN_SIZE, tileY0 = yMin/BIN_SIZE, tileY1 = (yMax - 1)/BIN_SIZE;
+    if(depthTest)
+    {
+        float farthest = -std::numeric_limits<float>::infinity();
+        for(int ty = tileY0; ty <= tileY1; ++ty)
+            for(int tx = tileX0; tx <= tileX1; ++tx)
+                farthest = std::max(farthest, tileFar[size_t(ty) * tileCols + tx]);
+        if(zNear >= farthest)
+            return;
+    }
+
+    // colors and depth are linear in the edge values: the sum of each vertex's value * edge value / (2 * doubled area),
+    // plus what the biases took off, which thin triangles would notice. Depth after the perspective divide is linear on
+    // screen, so this interpolates it perspective correctly
+    vfloat weights[4][3], unbias[4];
+    double zOrigin = 0.0, zStepX = 0.0, zStepY = 0.0;
+    const float scale = 1.f / float(2 * area);
+    for(int attribute = 0; attribute < (depthTest ? 4 : 3); ++attribute)
+    {
+        float offset = 0.f;
+        for(int v = 0; v < 3; ++v)
         {
-            auto bary_coords = get_barycentric_coords(a, b, c, {x + 0.5, y + 0.5});
-            if (std::get<0>(bary_coords) > 0 && std::get<1>(bary_coords) > 0 && std::get<2>(bary_coords) > 0)
+            float weight = (attribute < 3 ? per_vertex_color[v][attribute] * 255.f : z[v]) * scale;
+            weights[attribute][v] = set1(weight);
+            offset += weight * edges[v].bias;
+            if(attribute == 3)
             {
-                glm::vec3 color = per_vertex_color[0] * std::get<0>(bary_coords) + per_vertex_color[1] * std::get<1>(bary_coords) + 
-                per_vertex_color[2] * std::get<2>(bary_coords);
+                zOrigin += double(weight) * double(edges[v].origin + edges[v].bias);
+                zStepX += double(weight) * double(edges[v].stepX);
+                zStepY += double(weight) * double(edges[v].stepY);
+            }
+        }
+        unbias[attribute] = set1(offset);
+    }
+    auto interpolate = [&](int attribute, const vfloat (&w)[3])
+    {
+        return fmadd(weights[attribute][0], w[0], fmadd(weights[attribute][1], w[1], fmadd(weights[attribute][2], w[2], unbias[attribute])));
+    };
+    // nearest and farthest depth of the triangle over %width x %height pixels from (x, y), padded for rounding. The
+    // interpolated values round relative to the corners' depths, which can be far larger than the depth at (x, y)
+    const double zPad = 1e-5 * std::max(std::abs(zNear), std::abs(zFar)) + 1e-30;
+    auto depth_range = [&](int x, int y, int width, int height)
+    {
+        double base = zOrigin + zStepX * x + zStepY * y;
+        double pad = 1e-5 * (std::abs(base) + std::abs(zStepX * width) + std::abs(zStepY * height)) + zPad;
+        double low = base + std::min(0.0, zStepX * (width - 1)) + std::min(0.0, zStepY * (height - 1)) - pad;
+        double high = base + std::max(0.0, zStepX * (width - 1)) + std::max(0.0, zStepY * (height - 1)) + pad;
+        return std::pair<float, float>(float(std::max(low, zNear - zPad)), float(std::min(high, zFar + zPad)));
+    };
 
-                assert(!(y > rasterHeight || x > rasterWidth) || (x < 0 || y < 0));
+    // stores the %covered lanes of %values to %out. Whole steps blend with what is there, the tail of a row goes lane by lane
+    auto store = [](auto* out, auto values, vmask covered, size_t lanes)
+    {
+        if(lanes == WIDTH)
+        {
+            storeu(out, select(covered, values, loadu(out)));
+            return;
+        }
+        alignas(64) std::remove_pointer_t<decltype(out)> buffer[WIDTH];
+        storeu(buffer, values);
+        for(unsigned mask = bitmask(covered); mask != 0; mask &= mask - 1)
+        {
+            int lane = std::countr_zero(mask);
+            out[lane] = buffer[lane];
+        }
+    };
+    auto load_depth = [](const float* in, size_t lanes)
+    {
+        if(lanes == WIDTH)
+            return loadu(in);
+        alignas(64) float buffer[WIDTH] = {};
+        std::copy_n(in, lanes, buffer);
+        return loadu(buffer);
+    };
 
-                raster[y*rasterWidth + x] = {uint8_t(color.r * 255), uint8_t(color.g * 255), uint8_t(color.b * 255), 255};
+    tile_span pixels = span();
+    const vint alpha = set1(int32_t(0xff000000u));
+    const vint laneSteps[3] = {iota() * set1(int32_t(edges[0].stepX)), iota() * set1(int32_t(edges[1].stepX)), 
+    iota() * set1(int32_t(edges[2].stepX))};
+    // pixels [x0, x1) of rows [y0, y1), with the edge values stepped down a row at a time and along the row WIDTH pixels at
+    // a time. In %front every pixel is nearer than what the depth buffer holds, and the test can be skipped.
+    // %depthTested is a std::bool_constant, so the loop without depth has no trace of it
+    auto fill_run = [&](auto depthTested, int x0, int x1, int y0, int y1, bool front)
+    {
+        int32_t rowStart[3];
+        for(int e = 0; e < 3; ++e)
+            rowStart[e] = int32_t(edges[e].at(x0, y0));
+        for(int y = y0; y < y1; ++y)
+        {
+            RGBA32* row = pixels.row(y).data();
+            float* depthRow = depth.data() + size_t(y) * rasterWidth;
+            vint E[3];
+            for(int e = 0; e < 3; ++e)
+                E[e] = set1(rowStart[e]) + laneSteps[e];
+            for(int x = x0; x < x1; x += WIDTH)
+            {
+                size_t lanes = std::min<size_t>(WIDTH, x1 - x);
+                vmask covered = ((E[0] | E[1] | E[2]) > set1(-1)) & lanes_below(lanes);
+                if(any(covered))
+                {
+                    vfloat w[3] = {to_float(E[0]), to_float(E[1]), to_float(E[2])};
+                    if constexpr(depthTested)
+                    {
+                        vfloat nearer = interpolate(3, w);
+                        if(!front)
+                            covered &= nearer < load_depth(depthRow + x, lanes);
+                        store(depthRow + x, nearer, covered, lanes);
+                    }
+                    vint packed = alpha;
+                    for(int ch = 0; ch < 3; ++ch)
+                        packed = packed | (to_int(interpolate(ch, w)) << 8 * ch);
+                    store(reinterpret_cast<int32_t*>(row + x), packed, covered, lanes);
+                }
+                for(int e = 0; e < 3; ++e)
+                    E[e] += set1(int32_t(edges[e].stepX * WIDTH));
+            }
+            for(int e = 0; e < 3; ++e)
+                rowStart[e] += int32_t(edges[e].stepY);
+        }
+    };
+
+    // blocks on a grid shared with the hierarchical depth, skipped when outside an edge or behind what they hold. The
+    // rest are drawn in runs of neighbouring blocks, row by row
+    bool farLowered = false;
+    for(int by = yMin - yMin % BLOCK_SIZE; by < yMax; by += BLOCK_SIZE)
+    {
+        const int y0 = std::max(by, yMin), y1 = std::min(by + BLOCK_SIZE, yMax);
+        auto inside = [&](int x0, int x1)
+        {
+            return edges[0].max_over(x0, y0, x1 - x0, y1 - y0) >= 0 && edges[1].max_over(x0, y0, x1 - x0, y1 - y0) >= 0 &&
+            edges[2].max_over(x0, y0, x1 - x0, y1 - y0) >= 0;
+        };
+        // without depth nothing splits the row: a triangle crosses a row of blocks in one run of them
+        if(!depthTest)
+        {
+            int first = xMax, last = xMin;
+            for(int bx = xMin - xMin % BLOCK_SIZE; bx < xMax; bx += BLOCK_SIZE)
+            {
+                const int x0 = std::max(bx, xMin), x1 = std::min(bx + BLOCK_SIZE, xMax);
+                if(inside(x0, x1))
+                {
+                    first = std::min(first, x0);
+                    last = x1;
+                }
             }
+            if(first < last)
+                fill_run(std::false_type{}, first, last, y0, y1, true);
+            continue;
         }
+
+        const size_t blockRow = size_t(by/BLOCK_SIZE) * blockCols;
+        int runStart = -1;
+        bool front = true;
+        for(int bx = xMin - xMin % BLOCK_SIZE;; bx += BLOCK_SIZE)
+        {
+            bool visible = bx < xMax;
+            if(visible)
+            {
+                const int x0 = std::max(bx, xMin), x1 = std::min(bx + BLOCK_SIZE, xMax);
+                visible = inside(x0, x1);
+                if(visible)
+                {
+                    auto [low, high] = depth_range(x0, y0, x1 - x0, y1 - y0);
+                    const size_t block = blockRow + bx/BLOCK_SIZE;
+                    visible = low < blockFar[block];
+                    if(visible)
+                    {
+                        front = (runStart < 0 || front) && high < blockNear[block];
+                        // depths only ever decrease, so the block's range stays a bound without reading it back. Its
+                        // farthest drops too when the triangle covers all of it
+                        blockNear[block] = std::min(blockNear[block], low);
+                        const bool whole = x0 == bx && x1 - bx == std::min<int>(BLOCK_SIZE, rasterWidth - bx) &&
+                        y0 == by && y1 - by == std::min<int>(BLOCK_SIZE, rasterHeight - by) &&
+                        edges[0].min_over(x0, y0, x1 - x0, y1 - y0) >= 0 && edges[1].min_over(x0, y0, x1 - x0, y1 - y0) >= 0 &&
+                        edges[2].min_over(x0, y0, x1 - x0, y1 - y0) >= 0;
+                        if(whole && high < blockFar[block])
+                        {
+                            blockFar[block] = high;
+                            farLowered = true;
+                        }
+                    }
+                }
+            }
+            if(visible)
+            {
+                if(runStart < 0)
+                    runStart = bx;
+                continue;
+            }
+            if(runStart >= 0)
+            {
+                fill_run(std::true_type{}, std::max(runStart, xMin), std::min(bx, xMax), y0, y1, front);
+                runStart = -1;
+            }
+            if(bx >= xMax)
+                break;
+        }
+    }
+
+    // the farthest depth of each tile the triangle touched, from its blocks
+    if(farLowered)
+        for(int ty = tileY0; ty <= tileY1; ++ty)
+            for(int tx = tileX0; tx <= tileX1; ++tx)
+            {
+                float farthest = -std::numeric_limits<float>::infinity();
+                for(uint by = ty * (BIN_SIZE/BLOCK_SIZE); by < std::min<uint>((ty + 1) * (BIN_SIZE/BLOCK_SIZE), blockRows); ++by)
+                    for(uint bx = tx * (BIN_SIZE/BLOCK_SIZE); bx < std::min<uint>((tx + 1) * (BIN_SIZE/BLOCK_SIZE), blockCols); ++bx)
+                        farthest = std::max(farthest, blockFar[size_t(by) * blockCols + bx]);
+                tileFar[size_t(ty) * tileCols + tx] = farthest;
+            }
+}
+void AiCo::rasterizer::draw_triangles(std::span<const vertex> vertices, std::span<const uint32_t> indices, threadpool& pool)
+{
+    assert(indices.size() % 3 == 0);
+    const size_t nrTriangles = indices.size() / 3;
+
+    // corners behind the near plane or outside the guard band are marked with INVALID, and their triangles clipped
+    constexpr int INVALID = std::numeric_limits<int>::min();
+    screenVertices.resize(vertices.size());
+    screenDepths.resize(vertices.size());
+    pool.parallel_for(0, vertices.size(), 4096, [&](size_t i)
+    {
+        glm::vec4 h = worldToSCR * glm::vec4(vertices[i].position, 1.f);
+        glm::vec3 p = glm::vec3(h) / h.w;
+        bool inside = h.w > 0.f && h.z + h.w >= 0.f && std::abs(p.x) <= float(GUARD_BAND) && std::abs(p.y) <= float(GUARD_BAND) &&
+        std::isfinite(p.z);
+        screenVertices[i] = inside ? glm::vec<2, int>(p) : glm::vec<2, int>(INVALID);
+        screenDepths[i] = p.z;
+    });
+
+    // chunks of triangles are binned in parallel into lists of their own, so every tile reads its triangles in index
+    // order by going through the chunks in order. The pieces of clipped triangles are kept with their chunk, and binned
+    // in their triangle's place with the CLIPPED bit set
+    const uint nrCols = (rasterWidth + BIN_SIZE - 1)/BIN_SIZE, nrRows = (rasterHeight + BIN_SIZE - 1)/BIN_SIZE;
+    const size_t nrTiles = size_t(nrCols) * nrRows;
+    constexpr size_t CHUNK = 8192;
+    constexpr uint32_t CLIPPED = 1u << 31;
+    assert(nrTriangles < CLIPPED);
+    const size_t nrChunks = (nrTriangles + CHUNK - 1)/CHUNK;
+    if(bins.size() < nrChunks * nrTiles)
+        bins.resize(nrChunks * nrTiles);
+    if(clippedTriangles.size() < nrChunks)
+        clippedTriangles.resize(nrChunks);
+    pool.parallel_for(0, nrChunks, 1, [&](size_t chunk)
+    {
+        std::vector<uint32_t>* chunkBins = &bins[chunk * nrTiles];
+        for(size_t tile = 0; tile < nrTiles; ++tile)
+            chunkBins[tile].clear();
+        std::vector<clipped_triangle>& pieces = clippedTriangles[chunk];
+        pieces.clear();
+
+        // @return Whether any of the triangle is on screen
+        auto bin = [&](glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, uint32_t entry)
+        {
+            int xMin = std::max(std::min(std::min(a.x, b.x), c.x), 0);
+            int xMax = std::min(std::max(std::max(a.x, b.x), c.x), int(rasterWidth));
+            int yMin = std::max(std::min(std::min(a.y, b.y), c.y), 0);
+            int yMax = std::min(std::max(std::max(a.y, b.y), c.y), int(rasterHeight));
+            if(xMin >= xMax || yMin >= yMax)
+                return false;
+            for(int row = yMin/BIN_SIZE; row <= (yMax - 1)/BIN_SIZE; ++row)
+                for(int col = xMin/BIN_SIZE; col <= (xMax - 1)/BIN_SIZE; ++col)
+                    chunkBins[size_t(row) * nrCols + col].push_back(entry);
+            return true;
+        };
+        for(size_t t = chunk * CHUNK; t < std::min(nrTriangles, (chunk + 1) * CHUNK); ++t)
+        {
+            assert(indices[3*t] < vertices.size() && indices[3*t + 1] < vertices.size() && indices[3*t + 2] < vertices.size());
+            glm::vec<2, int> a = screenVertices[indices[3*t]], b = screenVertices[indices[3*t + 1]], c = screenVertices[indices[3*t + 2]];
+            if(a.x != INVALID && b.x != INVALID && c.x != INVALID)
+            {
+                bin(a, b, c, uint32_t(t));
+                continue;
+            }
+
+            // near plane and guard band are planes before the divide, where the triangle is cut and drawn as a fan
+            clip_vertex<float> polygon[MAX_CLIPPED];
+            for(int k = 0; k < 3; ++k)
+            {
+                const vertex& corner = vertices[indices[3*t + k]];
+                polygon[k] = {worldToSCR * glm::vec4(corner.position, 1.f), corner.color};
+            }
+            const int count = clip_polygon(polygon, 3, float(GUARD_BAND));
+            for(int i = 1; i + 1 < count; ++i)
+            {
+                const clip_vertex<float>* corners[3] = {&polygon[0], &polygon[i], &polygon[i + 1]};
+                clipped_triangle piece;
+                for(int k = 0; k < 3; ++k)
+                {
+                    piece.corners[k] = to_screen(corners[k]->position);
+                    piece.depths[k] = corners[k]->position.z / corners[k]->position.w;
+                    piece.colors[k] = corners[k]->color;
+                }
+                if(bin(piece.corners[0], piece.corners[1], piece.corners[2], CLIPPED | uint32_t(pieces.size())))
+                    pieces.push_back(piece);
+            }
+        }
+    });
+
+    pool.parallel_for(0, nrTiles, 1, [&](size_t tile)
+    {
+        const uint col = uint(tile % nrCols), row = uint(tile / nrCols);
+        const tile_rect clip = {col * BIN_SIZE, row * BIN_SIZE, std::min<uint>(BIN_SIZE, rasterWidth - col * BIN_SIZE),
+        std::min<uint>(BIN_SIZE, rasterHeight - row * BIN_SIZE)};
+        for(size_t chunk = 0; chunk < nrChunks; ++chunk)
+            for(uint32_t t : bins[chunk * nrTiles + tile])
+            {
+                if(t & CLIPPED)
+                {
+                    const clipped_triangle& piece = clippedTriangles[chunk][t & ~CLIPPED];
+                    fill_triangle(piece.corners[0], piece.corners[1], piece.corners[2], piece.colors, clip, &piece.depths);
+                    continue;
+                }
+                const uint32_t ia = indices[3*t], ib = indices[3*t + 1], ic = indices[3*t + 2];
+                const glm::vec3 depths = {screenDepths[ia], screenDepths[ib], screenDepths[ic]};
+                fill_triangle(screenVertices[ia], screenVertices[ib], screenVertices[ic],
+                {vertices[ia].color, vertices[ib].color, vertices[ic].color}, clip, &depths);
+            }
+    });
 }
 AiCo::rasterizer::~rasterizer()
 {
@@ -1,9 +1,23 @@
 #pragma once
 
 #include "output.h"
+#include "raster.h"
+
+#include <cstdint>
+#include <span>
+#include <vector>
 
 namespace AiCo
 {
+    class threadpool;
+
+    /// @brief Corner of the triangles of rasterizer::draw_triangles(): a point in world space and its color.
+    struct vertex
+    {
+        glm::vec3 position;
+        glm::vec3 color;
+    };
+
     class rasterizer
     { 
         RGBA32* raster;
@@ -23,21 +37,93 @@ namespace AiCo
          * @brief Projects points from a view frustum to an axis aligned view volume
          */
         glm::mat4 projectionTransform;
+        /// The product of the four above, world space to screen. Only the camera changes, so set_camera_transform() updates it.
+        glm::mat4 worldToSCR;
 
         bool ownsRaster = true;
+
+        /// Depth of every pixel after projection, -1 on the near plane and 1 on the far one. Smaller is nearer.
+        std::vector<float> depth;
+        /**
+         * Hierarchical depth: the nearest and farthest depth of every BLOCK_SIZE block, and the farthest of every
+         * BIN_SIZE tile. Triangles and blocks behind the farthest depth of what they cover are skipped without
+         * touching their pixels, and blocks in front of the nearest are drawn without reading the depth buffer.
+         */
+        std::vector<float> blockNear, blockFar, tileFar;
+        uint blockCols, blockRows, tileCols;
+
+        /// Part of a triangle of draw_triangles() left by clipping, projected to the screen.
+        struct clipped_triangle
+        {
+            glm::vec<2, int> corners[3];
+            glm::vec3 depths;
+            glm::vec<3, glm::vec3> colors;
+        };
+
+        // scratch of draw_triangles(), kept between calls
+        std::vector<glm::vec<2, int>> screenVertices;
+        std::vector<float> screenDepths;
+        std::vector<std::vector<uint32_t>> bins;
+        std::vector<std::vector<clipped_triangle>> clippedTriangles;
+
+        /**
+         * @brief draw_triangle_scr() limited to the pixels of %clip. Tests and writes the depth buffer if %vertexDepths,
+         * the depth of a, b and c, is given.
+         */
+        void fill_triangle(glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, glm::vec<3, glm::vec3> per_vertex_color,
+        const tile_rect& clip, const glm::vec3* vertexDepths = nullptr);
     public:
         uint rasterWidth, rasterHeight;
+
+        /// Triangles are clipped to screen coordinates within [-GUARD_BAND, GUARD_BAND], so edge functions fit 32 bits.
+        static constexpr int GUARD_BAND = 1 << 13;
+        /// Side of the pixel blocks draw_triangle_scr() rejects at once when they lie outside an edge.
+        static constexpr int BLOCK_SIZE = 8;
+        /// Side of the screen tiles draw_triangles() sorts triangles into and fills in parallel.
+        static constexpr int BIN_SIZE = 64;
+
         rasterizer(uint rasterWidth, uint rasterHeight, glm::vec2 XworldCoords = {-1, 1}, glm::vec2 YworldCoords = {-1, 1}, glm::vec2 ZworldCoords = {-1, 1}, RGBA32* rasterPtr = nullptr);
 
         void draw_point(glm::vec3 worldCoord, RGBA32 color);
+        /**
+         * @brief Draws the pixels of the midpoint line from %ScrP1 to %ScrP2 that are on the screen. The line is clipped to
+         * the screen before it is stepped, so its cost is the pixels drawn, and they are the ones the whole line would draw.
+         */
         void draw_line_midpoint_scr(glm::vec<2, int> ScrP1, glm::vec<2, int> ScrP2, RGBA32 color);
+        /// @brief draw_line_midpoint_scr() of the line between two world points, cut where it passes behind the near plane.
         void draw_line_midpoint_world(glm::vec3 worldP1, glm::vec3 worldP2, RGBA32 color = {255, 255, 255, 255});
         void sample_raster(uint sampleHeight, uint sampleWidth, RGBA32* sample);
+        /// @brief Fills the raster with %color and clears the depth buffer.
         void clear(RGBA32 color);
+        /// @brief Resets the depth buffer so that the next triangle drawn at any depth is visible.
+        void clear_depth();
+        /**
+         * @brief Fills the pixels whose centers are inside triangle (a, b, c), interpolating %per_vertex_color. Pixels on an
+         * edge shared by two triangles are drawn by one of them only (the top left rule). Either winding is drawn. Corners
+         * may be anywhere: a triangle reaching out of the guard band is cut down to it first.
+         */
         void draw_triangle_scr(glm::vec<2, int> a, glm::vec<2, int> b, glm::vec<2, int> c, glm::vec<3, glm::vec3> per_vertex_color);
+        /**
+         * @brief Draws the triangles of %indices, three indices into %vertices each, as if by draw_triangle_scr() one after
+         * the other. Vertices are transformed on %pool, triangles are sorted into BIN_SIZE tiles of the screen, and the
+         * tiles are filled on %pool, the calling thread included. Each tile draws its triangles in index order, so the
+         * result does not depend on the number of threads. Triangles crossing the near plane or the guard band are cut
+         * at them before the perspective divide, so what is behind the camera is never drawn.
+         * Pixels are depth tested: a triangle only covers what it is nearer than.
+         */
+        void draw_triangles(std::span<const vertex> vertices, std::span<const uint32_t> indices, threadpool& pool);
         void RGB_test();
         
         glm::vec<2, int> toSCR(glm::vec3 u);
+        /**
+         * @brief toSCR() of every point of %in, written to %out, which must be as long. Points go through the matrix
+         * simd::WIDTH at a time, their coordinates rearranged into one register each, so a pixel may come out one off
+         * where toSCR() rounds the other way.
+         */
+        void transform_points(std::span<const glm::vec3> in, std::span<glm::vec<2, int>> out)const;
+
+        /// @return The pixels drawn to, as rows %rasterWidth pixels apart.
+        [[nodiscard]] tile_span span()const{return {raster, rasterWidth, rasterWidth, rasterHeight};}
 
         void set_camera_transform(glm::vec3 origin, glm::vec3 view_direction, glm::vec3 up_direction);
 
@@ -0,0 +1,443 @@
+#pragma once
+
+#include "interval.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/ray.h"
+#include "metrics.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <numeric>
+#include <memory>
+#include <optional>
+#include <utility>
+#include <vector>
+
+namespace AiCo
+{
+    namespace RT
+    {
+        /**
+         * @brief Flat bounding volume hierarchy over a set of primitive bounds, built with the binned surface area heuristic.
+         * The tree knows nothing about the primitives themselves, leaves reference ranges of %primIndices which map back to
+         * the bounds the tree was built from.
+         */
+        class bvh_tree
+        {
+        public:
+            struct node
+            {
+                AABB bounds;
+                /// Leaves: index of the first entry in primIndices. Interior nodes: index of the left child, the right child is first + 1.
+                uint32_t first = 0;
+                /// Number of primitives in a leaf, 0 for interior nodes.
+                uint32_t count = 0;
+
+                [[nodiscard]] inline bool leaf()const{return count != 0;}
+            };
+
+            static constexpr uint32_t NONE = UINT32_MAX;
+            static constexpr uint32_t BINS = 16;
+            static constexpr uint32_t MAX_LEAF_SIZE = 4;
+            static constexpr uint32_t MAX_DEPTH = 64;
+            static constexpr float TRAVERSAL_COST = 1.f;
+            static constexpr float INTERSECT_COST = 1.f;
+
+            std::vector<node> nodes;
+            std::vector<uint32_t> primIndices;
+            /// Parent of every node, NONE for the root.
+            std::vector<uint32_t> parents;
+            /// Leaf containing every primitive, indexed like the bounds the tree was built from.
+            std::vector<uint32_t> primLeaves;
+
+            /// Nodes holding more primitives than this are always split, even where the SAH would prefer a leaf.
+            uint32_t maxLeafSize = MAX_LEAF_SIZE;
+
+            bvh_tree() = default;
+            explicit bvh_tree(const std::vector<AABB>& primBounds, uint32_t maxLeafSize = MAX_LEAF_SIZE) : maxLeafSize(maxLeafSize)
+            {
+                build(primBounds);
+            }
+
+            void build(const std::vector<AABB>& primBounds)
+            {
+                nodes.clear();
+                primIndices.resize(primBounds.size());
+                std::iota(primIndices.begin(), primIndices.end(), 0);
+
+                if(!primBounds.empty())
+                {
+                    std::vector<glm::vec3> centroids(primBounds.size());
+                    for(size_t i = 0; i < primBounds.size(); ++i)
+                        centroids[i] = primBounds[i].centroid();
+
+                    // a binary tree with n leaves has 2n - 1 nodes. Reserving up front keeps node references valid while subdividing
+                    nodes.reserve(2 * primBounds.size() - 1);
+                    nodes.push_back({AABB(), 0, uint32_t(primBounds.size())});
+                    subdivide(0, primBounds, centroids, 0);
+                }
+                link();
+            }
+
+            /**
+             * @brief Updates node bounds bottom-up from the leaves of %changedPrims, keeping the topology. 
+             * Costs O(changed primitives * depth), and stops climbing as soon as a node's bounds are unaffected.
+             * @param primBounds Callable as AABB(uint32_t prim), returning the current bounds of a primitive.
+             */
+            template<typename bounds_fn>
+            void refit(const std::vector<uint32_t>& changedPrims, bounds_fn&& primBounds)
+            {
+                for(uint32_t prim : changedPrims)
+                {
+                    assert(prim < primLeaves.size());
+                    uint32_t idx = primLeaves[prim];
+
+                    AABB bounds;
+                    for(uint32_t i = nodes[idx].first; i < nodes[idx].first + nodes[idx].count; ++i)
+                        bounds.expand(primBounds(primIndices[i]));
+
+                    while(true)
+                    {
+                        node& N = nodes[idx];
+                        if(N.bounds == bounds)
+                            break;
+
+                        weightedArea += cost_of(N) * (bounds.surface_area() - N.bounds.surface_area());
+                        N.bounds = bounds;
+
+                        if(parents[idx] == NONE)
+                            break;
+                        idx = parents[idx];
+                        bounds = nodes[nodes[idx].first].bounds;
+                        bounds.expand(nodes[nodes[idx].first + 1].bounds);
+                    }
+                }
+            }
+
+            /**
+             * @brief Expected cost of tracing a random ray through the tree according to the surface area heuristic.
+             * Maintained incrementally, so it is O(1) even after refitting.
+             */
+            [[nodiscard]] inline float sah_cost()const
+            {
+                if(nodes.empty())
+                    return 0.f;
+                float rootArea = nodes[0].bounds.surface_area();
+                return rootArea > 0.f ? weightedArea/rootArea : 0.f;
+            }
+
+            /**
+             * @brief Visits the leaves pierced by %R front to back, skipping subtrees that start beyond the closest hit so far.
+             * @param leaf Callable as float(uint32_t first, uint32_t count, interval K). Tests the primitives
+             * primIndices[first, first + count) within K and returns the distance of the closest hit, or K.max if there is none.
+             */
+            template<typename leaf_fn>
+            void traverse(const ray& R, interval K, leaf_fn&& leaf)const
+            {
+                if(nodes.empty())
+                    return;
+                if(auto rootK = nodes[0].bounds.clip(R, K); rootK.empty())
+                    return;
+
+                struct entry{uint32_t idx; float tNear;};
+                entry stack[MAX_DEPTH + 1];
+                size_t top = 0;
+
+                float tMax = K.max;
+                stack[top++] = {0, K.min};
+                while(top != 0)
+                {
+                    entry current = stack[--top];
+                    if(current.tNear > tMax)
+                        continue;
+
+                    const node& N = nodes[current.idx];
+                    if(N.leaf())
+                    {
+                        tMax = std::min(tMax, leaf(N.first, N.count, interval(K.min, tMax)));
+                        continue;
+                    }
+
+                    uint32_t nearIdx = N.first, farIdx = N.first + 1;
+                    auto leftK = nodes[nearIdx].bounds.clip(R, {K.min, tMax});
+                    auto rightK = nodes[farIdx].bounds.clip(R, {K.min, tMax});
+                    bool nearHit = !leftK.empty(), farHit = !rightK.empty();
+                    float nearT = leftK.min, farT = rightK.min;
+
+                    if(farHit && (!nearHit || farT < nearT))
+                    {
+                        std::swap(nearIdx, farIdx);
+                        std::swap(nearHit, farHit);
+                        std::swap(nearT, farT);
+                    }
+                    // push the far child first so the near one is popped first
+                    if(farHit)
+                        stack[top++] = {farIdx, farT};
+                    if(nearHit)
+                        stack[top++] = {nearIdx, nearT};
+                }
+            }
+
+        private:
+            /// Sum of the surface area of every node weighted by its cost. Divided by the root area this is the SAH cost.
+            float weightedArea = 0.f;
+
+            [[nodiscard]] static inline float cost_of(const node& N){return N.leaf() ? INTERSECT_COST * N.count : TRAVERSAL_COST;}
+
+            void link()
+            {
+                parents.assign(nodes.size(), NONE);
+                primLeaves.assign(primIndices.size(), NONE);
+                weightedArea = 0.f;
+                for(uint32_t i = 0; i < nodes.size(); ++i)
+                {
+                    const node& N = nodes[i];
+                    weightedArea += cost_of(N) * N.bounds.surface_area();
+                    if(N.leaf())
+                        for(uint32_t j = N.first; j < N.first + N.count; ++j)
+                            primLeaves[primIndices[j]] = i;
+                    else
+                        parents[N.first] = parents[N.first + 1] = i;
+                }
+            }
+
+            void subdivide(uint32_t nodeIdx, const std::vector<AABB>& primBounds, const std::vector<glm::vec3>& centroids, uint32_t depth)
+            {
+                const uint32_t first = nodes[nodeIdx].first, count = nodes[nodeIdx].count;
+
+                AABB bounds, centroidBounds;
+                for(uint32_t i = first; i < first + count; ++i)
+                {
+                    bounds.expand(primBounds[primIndices[i]]);
+                    centroidBounds.expand(centroids[primIndices[i]]);
+                }
+                nodes[nodeIdx].bounds = bounds;
+
+                if(count <= 1 || depth + 1 >= MAX_DEPTH)
+                    return;
+
+                struct bin{AABB bounds; uint32_t count = 0;};
+
+                float bestCost = INF;
+                int bestAxis = -1;
+                uint32_t bestSplit = 0;
+
+                const float parentArea = bounds.surface_area();
+                for(int axis = 0; axis < 3; ++axis)
+                {
+                    const float lo = centroidBounds.min[axis], extent = centroidBounds.max[axis] - lo;
+                    if(!(extent > 0.f))
+                        continue;
+
+                    bin bins[BINS];
+                    const float scale = BINS/extent;
+                    for(uint32_t i = first; i < first + count; ++i)
+                    {
+                        uint32_t b = std::min(BINS - 1, uint32_t((centroids[primIndices[i]][axis] - lo) * scale));
+                        bins[b].count++;
+                        bins[b].bounds.expand(primBounds[primIndices[i]]);
+                    }
+
+                    // sweep from both ends, split k puts bins [0, k] on the left
+                    float leftArea[BINS - 1], rightArea[BINS - 1];
+                    uint32_t leftCount[BINS - 1], rightCount[BINS - 1];
+                    AABB leftBox, rightBox;
+                    uint32_t leftSum = 0, rightSum = 0;
+                    for(uint32_t k = 0; k < BINS - 1; ++k)
+                    {
+                        leftSum += bins[k].count;
+                        leftCount[k] = leftSum;
+                        leftArea[k] = leftBox.expand(bins[k].bounds).surface_area();
+
+                        rightSum += bins[BINS - 1 - k].count;
+                        rightCount[BINS - 2 - k] = rightSum;
+                        rightArea[BINS - 2 - k] = rightBox.expand(bins[BINS - 1 - k].bounds).surface_area();
+                    }
+                    for(uint32_t k = 0; k < BINS - 1; ++k)
+                    {
+                        if(leftCount[k] == 0 || rightCount[k] == 0)
+                            continue;
+                        float cost = leftCount[k] * leftArea[k] + rightCount[k] * rightArea[k];
+                        if(cost < bestCost)
+                        {
+                            bestCost = cost;
+                            bestAxis = axis;
+                            bestSplit = k;
+                        }
+                    }
+                }
+
+                uint32_t leftCount = 0;
+                if(bestAxis != -1)
+                {
+                    bestCost = parentArea > 0.f ? TRAVERSAL_COST + INTERSECT_COST * bestCost/parentArea : INF;
+                    if(bestCost >= INTERSECT_COST * count && count <= maxLeafSize)
+                        return;
+
+                    const float lo = centroidBounds.min[bestAxis];
+                    const float scale = BINS/(centroidBounds.max[bestAxis] - lo);
+                    auto mid = std::partition(primIndices.begin() + first, primIndices.begin() + first + count,
+                    [&](uint32_t prim)
+                    {
+                        return std::min(BINS - 1, uint32_t((centroids[prim][bestAxis] - lo) * scale)) <= bestSplit;
+                    });
+                    leftCount = uint32_t(mid - (primIndices.begin() + first));
+                }
+                else if(count <= maxLeafSize)
+                    return;
+
+                // all centroids coincide, any split is as good as any other
+                if(leftCount == 0 || leftCount == count)
+                    leftCount = count/2;
+
+                uint32_t leftIdx = uint32_t(nodes.size());
+                nodes.push_back({AABB(), first, leftCount});
+                nodes.push_back({AABB(), first + leftCount, count - leftCount});
+                nodes[nodeIdx].first = leftIdx;
+                nodes[nodeIdx].count = 0;
+
+                subdivide(leftIdx, primBounds, centroids, depth + 1);
+                subdivide(leftIdx + 1, primBounds, centroids, depth + 1);
+            }
+        };
+
+        /**
+         * @brief Nearest intersection over a list of bounded primitives, accelerated by a bvh_tree.
+         * Drop-in replacement for nearest_intersect. The primitives are not owned and must outlive this object.
+         * 
+         * Animated primitives are handled by refit(), which only touches the ancestors of the primitives that moved.
+         * Refitting degrades the tree over time, so once its SAH cost grows past %rebuildThreshold times the cost it was 
+         * built with, a full rebuild is scheduled on %builder and swapped in by a later call to refit().
+         * @warning Neither refit() nor rebuild() may be called while the tree is being traced.
+         */
+        class bvh final : public bounded_geometry
+        {
+        public:
+            std::vector<const bounded_geometry*> prims;
+            
+            float rebuildThreshold = 1.5f;
+
+            /**
+             * @param builder Pool that runs background rebuilds. If null, rebuilds happen synchronously inside refit().
+             * It should not be the pool that renders the scene, since waiting on that pool would also wait on the rebuild.
+             */
+            bvh(const std::vector<const bounded_geometry*>& prims, threadpool* builder = nullptr) : prims(prims), builder(builder) 
+            {
+                rebuild();
+            }
+
+            void rebuild()
+            {
+                pendingRebuild.reset();
+                changedSinceSnapshot.clear();
+
+                tree.build(snapshot_bounds());
+                buildCost = tree.sah_cost();
+            }
+
+            /**
+             * @brief Updates the tree after the primitives at indices %changedPrims of %prims moved or changed size.
+             */
+            void refit(const std::vector<uint32_t>& changedPrims)
+            {
+                adopt_rebuild();
+
+                tree.refit(changedPrims, [this](uint32_t prim){return prims[prim]->bounds();});
+
+                if(pendingRebuild)
+                    changedSinceSnapshot.insert(changedSinceSnapshot.end(), changedPrims.begin(), changedPrims.end());
+                else if(degradation() > rebuildThreshold)
+                    schedule_rebuild();
+            }
+
+            /// @return Ratio of the current SAH cost to the SAH cost right after the last build.
+            [[nodiscard]] inline float degradation()const{return buildCost > 0.f ? tree.sah_cost()/buildCost : 1.f;}
+
+            /// @brief Nearest hit among the primitives. The record is the primitive's own, and resolved by it.
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const override
+            {
+                std::optional<hit_record> result = {};
+                tree.traverse(R, K, [this, &R, &result](uint32_t first, uint32_t count, interval K) -> float
+                {
+                    float closestIntersect = K.max;
+                    for(uint32_t i = first; i < first + count; ++i)
+                    {
+                        count_intersect();
+
+                        if(auto record = prims[tree.primIndices[i]]->hit(R, {K.min, closestIntersect}); record.has_value())
+                            if(record->t < closestIntersect)
+                            {
+                                closestIntersect = record->t;
+                                result = record;
+                            }
+                    }
+                    return closestIntersect;
+                });
+                return result;
+            }
+
+            [[nodiscard]] virtual AABB bounds()const override
+            {
+                return tree.nodes.empty() ? AABB() : tree.nodes[0].bounds;
+            }
+
+        private:
+            struct rebuild_state
+            {
+                bvh_tree tree;
+                std::atomic<bool> ready = false;
+            };
+
+            bvh_tree tree;
+            float buildCost = 0.f;
+
+            threadpool* builder;
+            std::shared_ptr<rebuild_state> pendingRebuild;
+            std::vector<uint32_t> changedSinceSnapshot;
+
+            [[nodiscard]] std::vector<AABB> snapshot_bounds()const
+            {
+                std::vector<AABB> primBounds;
+                primBounds.reserve(prims.size());
+                for(const auto prim : prims)
+                    primBounds.push_back(prim->bounds());
+                return primBounds;
+            }
+
+            void schedule_rebuild()
+            {
+                if(!builder)
+                {
+                    rebuild();
+                    return;
+                }
+                // the primitives may move while the job runs, so it builds from a copy of their bounds
+                pendingRebuild = std::make_shared<rebuild_state>();
+                builder->enqueue_job([state = pendingRebuild, primBounds = snapshot_bounds()]()
+                {
+                    state->tree.build(primBounds);
+                    state->ready.store(true, std::memory_order_release);
+                });
+            }
+
+            void adopt_rebuild()
+            {
+                if(!pendingRebuild || !pendingRebuild->ready.load(std::memory_order_acquire))
+                    return;
+
+                tree = std::move(pendingRebuild->tree);
+                buildCost = tree.sah_cost();
+                pendingRebuild.reset();
+
+                // bring the new tree up to date with whatever moved after its bounds were copied
+                tree.refit(changedSinceSnapshot, [this](uint32_t prim){return prims[prim]->bounds();});
+                changedSinceSnapshot.clear();
+            }
+        };
+    }
+}
@@ -3,9 +3,11 @@
 #include "glm/fwd.hpp"
 #include "glm/geometric.hpp"
 #include "ray.h"
+#include "sampling.h"
 #include "utils.h"
 
 #include <cassert>
+#include <concepts>
 #include <cstddef>
 #include <cstdio>
 #include <functional>
@@ -15,6 +17,13 @@ namespace AiCo
     namespace RT
     {
         typedef std::function<ray(size_t x, size_t y)> camera_t;
+
+        /// Anything that generates a ray sample through pixel (x, y). Satisfied by camera_t and by every camera subclass.
+        template<typename T>
+        concept camera_like = requires(const T& view, size_t x, size_t y)
+        {
+            {view(x, y)} -> std::convertible_to<ray>;
+        };
         
         class camera
         {
@@ -47,8 +56,8 @@ namespace AiCo
 
             ray operator()(size_t x, size_t y) const noexcept override
             {
-                auto pxOffset = randvec_in_unit_disk();
-                auto defocusOffset = defocusRadius * randvec_in_unit_disk();
+                auto pxOffset = sampling::concentric_disk(sampling::rand2());
+                auto defocusOffset = defocusRadius * sampling::concentric_disk(sampling::rand2());
                 return ray(topleft + float(x + 0.5 + pxOffset.x) * (pxWidth * u) - float(y + 0.5 + pxOffset.y) * (pxHeight * v), 
                 eye + defocusOffset.x * u + defocusOffset.y * v);
             }
@@ -136,7 +145,7 @@ namespace AiCo
             {
                 assert(x < imgWidth && y < imgHeight);
                 using namespace glm;
-                auto lensRand = randvec_in_unit_disk();
+                auto lensRand = sampling::concentric_disk(sampling::rand2());
                 glm::vec2 offset(rand() - 0.5f, rand() - 0.5f);
                 return ray(topleftpx + vec3((x + offset.x) * pxdeltaU, (-y + offset.y) * pxdeltaV, 0),
                 eye + defocusRadius*(lensRand.x * u + lensRand.y * v));
@@ -7,12 +7,17 @@
 #include "utils.h"
 
 #include <atomic>
+#include <cassert>
+#include <concepts>
 #include <cfloat>
 #include <cstddef>
 #include <functional>
 #include <limits.h>
+#include <cmath>
+#include <algorithm>
 #include <optional>
 #include <utility>
+#include <vector>
 
 namespace AiCo 
 {
@@ -20,57 +25,120 @@ namespace AiCo
     {
         typedef std::function<bool(ray R)> spatial_rejector_t;
         
+        /**
+         * @brief Axis aligned bounding box. Default constructed boxes are empty, i.e., min > max, 
+         * and expanding them by any box or point yields that box or point.
+         */
         class AABB
         {
+        public:
             glm::vec3 min, max;
 
-            bool operator()(const ray& R)
+            AABB() : min(+INF), max(-INF) {}
+            AABB(const glm::vec3& min, const glm::vec3& max) : min(min), max(max) {}
+
+            [[nodiscard]] inline bool empty()const{return min.x > max.x || min.y > max.y || min.z > max.z;}
+
+            [[nodiscard]] inline bool operator==(const AABB& other)const{return min == other.min && max == other.max;}
+
+            [[nodiscard]] inline glm::vec3 centroid()const{return 0.5f * (min + max);}
+            
+            [[nodiscard]] inline float surface_area()const
+            {
+                if(empty())
+                    return 0.f;
+                glm::vec3 d = max - min;
+                return 2.f * (d.x * d.y + d.y * d.z + d.z * d.x);
+            }
+
+            inline AABB& expand(const AABB& other)
+            {
+                min = glm::min(min, other.min);
+                max = glm::max(max, other.max);
+                return *this;
+            }
+            inline AABB& expand(const glm::vec3& P)
             {
-                //reject parallel rays that start outside the box
-                if (R.dir.x == 0 && (R.origin.x < min.x || R.origin.x > max.x)) return false;
-                if (R.dir.y == 0 && (R.origin.y < min.y || R.origin.y > max.y)) return false;
-                if (R.dir.z == 0 && (R.origin.z < min.z || R.origin.z > max.z)) return false;
- 
-                auto invDir = 1.f/R.dir;
-                
-                float Xtmin = invDir.x * (min.x - R.origin.x);
-                float Xtmax = invDir.x * (max.x - R.origin.x);
-                if(invDir.x < 0.f) std::swap(Xtmin, Xtmax);
-                
-                if(Xtmin > Xtmax) return false;
-
-                float Ytmin = invDir.y * (min.y - R.origin.y);
-                float Ytmax = invDir.y * (max.y - R.origin.y);
-                if(invDir.y < 0.f) std::swap(Ytmin, Ytmax);
-
-                if(Ytmin > Ytmax) return false;
-                
-                auto XYoverlap = overlap({Xtmin, Xtmax}, {Ytmin, Ytmax});
-                if(XYoverlap.empty()) return false;
-                
-                float Ztmin = invDir.z * (min.z - R.origin.z);
-                float Ztmax = invDir.z * (max.z - R.origin.z);
-                if(invDir.z < 0.f) std::swap(Ztmin, Ztmax);
-                
-                if(Ztmin > Ztmax) return false;
-
-                auto XYZoverlap = overlap({Ztmin, Ztmax}, XYoverlap);
-
-                return !XYZoverlap.empty();
-            };
+                min = glm::min(min, P);
+                max = glm::max(max, P);
+                return *this;
+            }
+
+            /**
+             * @brief Slab test. 
+             * @return The part of %K for which %R is inside the box. Empty if %R misses the box within %K.
+             */
+            [[nodiscard]] inline interval clip(const ray& R, interval K)const
+            {
+                // the ray's sign picks the side of each slab it enters through, so no min/max is needed per axis.
+                // R.invDir is +-INF on axes the ray is parallel to, which makes rays inside the slab span the whole line
+                // and rays outside the slab produce an empty interval.
+                glm::vec3 near = {corner(R.sign[0]).x, corner(R.sign[1]).y, corner(R.sign[2]).z};
+                glm::vec3 far = {corner(1 - R.sign[0]).x, corner(1 - R.sign[1]).y, corner(1 - R.sign[2]).z};
+
+                glm::vec3 tNear = (near - R.origin) * R.invDir;
+                glm::vec3 tFar = (far - R.origin) * R.invDir;
+
+                return {std::max(std::max(K.min, tNear.x), std::max(tNear.y, tNear.z)), 
+                std::min(std::min(K.max, tFar.x), std::min(tFar.y, tFar.z))};
+            }
+
+            [[nodiscard]] inline bool operator()(const ray& R, interval K)const{return !clip(R, K).empty();}
+
+        private:
+            /// @return min for 0, max for 1.
+            [[nodiscard]] inline const glm::vec3& corner(int side)const{return side ? max : min;}
         };
         
 
-        typedef std::function<std::optional<intersection_t>(ray R, interval k)> intersector_t;
+        typedef std::function<std::optional<intersection_t>(const ray& R, interval k)> intersector_t;
+
+        /// Anything that finds the nearest intersection of a ray within an interval. Satisfied by intersector_t and every geometry.
+        template<typename T>
+        concept scene_like = requires(const T& scene, ray R, interval K)
+        {
+            {scene(R, K)} -> std::same_as<std::optional<intersection_t>>;
+        };
+        /**
+         * @brief Geometry finds intersections in two steps. hit() searches for the nearest hit and only records where it is,
+         * and resolve() turns that record into a full intersection_t once the search is over. Composite geometry forwards 
+         * the records of its parts, so whatever is hit resolves its own records.
+         */
         class geometry
         {
         public:
-            [[nodiscard]] virtual std::optional<intersection_t> operator()(ray R, interval K)const = 0;
+            /// @return Nearest hit of %R within %K.
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const = 0;
+
+            /// @return The intersection described by %record, which this geometry's hit() returned for %R.
+            [[nodiscard]] virtual intersection_t resolve(const ray& R, const hit_record& record)const
+            {
+                // composites never own records, they return their parts'
+                assert(record.owner != this);
+                return record.owner->resolve(R, record);
+            }
+
+            /// @return Nearest intersection of %R within %K, by resolving what hit() found.
+            [[nodiscard]] virtual std::optional<intersection_t> operator()(const ray& R, interval K)const
+            {
+                if(auto record = hit(R, K); record.has_value())
+                    return record->owner->resolve(R, *record);
+                return {};
+            }
 
             virtual ~geometry() = default;
         };
 
-        class sphere : public geometry
+        /**
+         * @brief Geometry that can report a bounding box, which is what acceleration structures are built over.
+         */
+        class bounded_geometry : public geometry
+        {
+        public:
+            [[nodiscard]] virtual AABB bounds()const = 0;
+        };
+
+        class sphere : public bounded_geometry
         {
         public:
             float radius;
@@ -81,13 +149,7 @@ namespace AiCo
             sphere() = delete;
             sphere(float radius, glm::vec3 center, const material_t& mat) : radius(radius), center(center), mat(mat) {}
             
-            [[nodiscard]] virtual std::optional<intersection_t> operator()(ray R, interval K)const override
-            {
-                return test_intersect(R, K);
-            }
-            
-        private:
-            [[nodiscard]] virtual std::optional<intersection_t> test_intersect(ray R, interval K)const
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const override
             {
                 //just copied this code from RT in one weekend. should work
                 glm::vec3 oc = center - R.origin;
@@ -108,10 +170,28 @@ namespace AiCo
                     if (!K.contains(root))
                         return {};
                 }
-                
-                glm::vec3 P = R.at(root);
-                return intersection_t(R, (P - center)/radius, P, root, mat);
+                return hit_record{root, 0, glm::vec2(0.f), this};
+            }
+
+            [[nodiscard]] virtual intersection_t resolve(const ray& R, const hit_record& record)const override
+            {
+                glm::vec3 P = R.at(record.t);
+                glm::vec3 N = (P - center)/radius;
+                return intersection_t(R, N, P, record.t, surface_coords(N), mat);
+            }
+            
+            [[nodiscard]] virtual AABB bounds()const override
+            {
+                glm::vec3 extent(std::abs(radius));
+                return {center - extent, center + extent};
             }
+
+            /// @return Spherical coordinates of the unit normal %N in [0, 1]^2, u around the y axis and v from the south pole.
+            [[nodiscard]] static inline glm::vec2 surface_coords(const glm::vec3& N)
+            {
+                return {(std::atan2(-N.z, N.x) + PI)/(2.f * PI), std::acos(std::clamp(-N.y, -1.f, 1.f))/PI};
+            }
+
         };
         
         class nearest_intersect : public geometry
@@ -121,33 +201,51 @@ namespace AiCo
             
             nearest_intersect(const std::vector<intersector_t>& list) : list(list) {}
 
-            [[nodiscard]] virtual std::optional<intersection_t> operator()(ray R, interval K)const override
+            /// @return The closest of the intersections of %list, as the winning intersector produced it.
+            [[nodiscard]] virtual std::optional<intersection_t> operator()(const ray& R, interval K)const override
             {
-                return test_intersect(R, K);
+                std::optional<intersection_t> closest = {};
+                for(const intersector_t& intersector : list)
+                {
+                    count_intersect();
+
+                    if(auto insct = intersector(R, {K.min, closest ? closest->t : K.max}); insct.has_value())
+                        if(!closest || insct->t < closest->t)
+                            closest = insct;
+                }
+                return closest;
             }
 
-        private:
-            [[nodiscard]] inline virtual std::optional<intersection_t> test_intersect(ray R, interval K)const
+            /// @brief Keeps the distance and index of the closest intersector. %prim of the result indexes %list.
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const override
             {
-                std::optional<intersection_t> result = {};
+                std::optional<hit_record> result = {};
                 float closestIntersect = K.max;
-                for(const auto& insctr : list)
+                for(uint32_t i = 0; i < list.size(); ++i)
                 {
-                    // intersection count mechanism. add thread local variable to globabl atomic every 2^16 intersects
-                    LOCAL_INSCT_CNTR++;
-                    if(LOCAL_INSCT_CNTR%(1<<16) == 0)
-                        INSCT_CNTR.fetch_add(1<<16, std::memory_order_relaxed);
-                    //
+                    count_intersect();
 
-                    if(auto insct = insctr(R, {K.min, closestIntersect}); insct.has_value())
+                    if(auto insct = list[i](R, {K.min, closestIntersect}); insct.has_value())
                         if(insct->t < closestIntersect)
                         {
                             closestIntersect = insct->t;
-                            result.emplace(*insct);
+                            result = hit_record{insct->t, i, glm::vec2(0.f), this};
                         }
                 }
                 return result;
             }
+
+            /**
+             * @brief For records of hit() through a geometry reference. Type erased intersectors only produce full
+             * intersections, so this costs one extra intersection per ray: the winner is asked again from just below t.
+             */
+            [[nodiscard]] virtual intersection_t resolve(const ray& R, const hit_record& record)const override
+            {
+                auto insct = list[record.prim](R, {std::nextafter(record.t, -INF), INF});
+                // the intersector found t before and is asked for its nearest hit from below it
+                assert(insct.has_value());
+                return *insct;
+            }
         };
     };
 };
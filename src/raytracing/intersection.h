@@ -3,35 +3,53 @@
 #include "raytracing/ray.h"
 #include "format.h"
 
+#include <cstdint>
+#include <functional>
 #include <optional>
 
 namespace AiCo::RT
 {
     struct material_t;
+    class geometry;
 
     struct intersection_t
     {
-        intersection_t(const ray& R, const glm::vec3& outwardNormal, const glm::vec3& P, float t, const glm::vec2& surface_coords, 
-        const material_t& mat) : 
-        P(P), N(outwardNormal), inDir(R.dir), t(t), frontFace(glm::dot(outwardNormal, R.dir) < 0), UV(surface_coords), mat(mat) {}
-        
+        intersection_t(const ray& R, const glm::vec3& outwardNormal, const glm::vec3& P, float t, const glm::vec2& surface_coords,
+        const material_t& mat) :
+        P(P), N(outwardNormal), inDir(R.dir), t(t), frontFace(glm::dot(outwardNormal, R.dir) < 0), UV(surface_coords), mat(&mat) {}
+
         intersection_t() = delete;
 
-        const glm::vec3 P, N, inDir;
-        const float t;
-        const bool frontFace;
-        
-        const glm::vec2 UV;
+        glm::vec3 P, N, inDir;
+        float t;
+        bool frontFace;
+
+        glm::vec2 UV;
 
-        const material_t& mat;
+        const material_t* mat;
     };
+
+    /**
+     * @brief What a geometry records while searching for the nearest hit. Small enough that keeping the closest one
+     * costs nothing. Only the final hit of a ray is turned into an intersection_t, by %owner's resolve().
+     */
+    struct hit_record
+    {
+        float t;
+        /// Which primitive of %owner was hit.
+        uint32_t prim;
+        /// Where on that primitive, for primitives that parametrize their surface (e.g. barycentrics on triangles).
+        glm::vec2 barycentrics;
+        const geometry* owner;
+    };
+
     typedef std::function<color3f(const intersection_t&)> texturer_t;
-    
+
     struct scatter_t
     {
         scatter_t(const ray& out) : out(out) {}
         scatter_t() = delete;
-        const ray out;
+        ray out;
     };
     typedef std::function<std::optional<scatter_t>(const intersection_t&)> scatterer_t;
 
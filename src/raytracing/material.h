@@ -5,6 +5,7 @@
 
 #include "format.h"
 #include "raytracing/ray.h"
+#include "sampling.h"
 #include "utils.h"
 #include "intersection.h"
 
@@ -29,10 +30,8 @@ namespace AiCo
 
             [[nodiscard]] virtual std::optional<scatter_t> operator()(const intersection_t& insct)const override
             {
-                glm::vec3 scatterDir = insct.N + randvec_on_unit_sphere();
-                if(nearzero_vec(scatterDir))
-                    scatterDir = insct.N;
-                return scatter_t(ray(scatterDir, insct.P));
+                // N is unit only up to rounding in the geometry, which would compound over bounces if taken as unit
+                return scatter_t(ray(sampling::cosine_hemisphere(insct.N, sampling::rand2()), insct.P));
             }
         };
         class metallic : public scatter_model
@@ -43,7 +42,7 @@ namespace AiCo
             metallic(color3f albedo = {1.f, 1.f, 1.f}, float fuzz = 0.15) : albedo(albedo), fuzz(fuzz) {}
             [[nodiscard]] virtual std::optional<scatter_t> operator()(const intersection_t& insct)const override
             {
-                return scatter_t(ray(fuzz * randvec_on_unit_sphere() + reflect(insct.inDir, insct.N), insct.P));
+                return scatter_t(ray(fuzz * sampling::uniform_sphere(sampling::rand2()) + reflect(insct.inDir, insct.N), insct.P));
             }
         };
     }
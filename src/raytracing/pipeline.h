@@ -1,5 +1,6 @@
 #pragma once
 
+#include <concepts>
 #include <cstddef>
 #include <functional>
 
@@ -13,6 +14,14 @@ namespace AiCo
     namespace RT 
     {
         typedef std::function<color3f(size_t x, size_t y)> pipeline_t;
+
+        /// Anything that computes one color sample of pixel (x, y).
+        template<typename T>
+        concept pipeline_like = requires(const T& pipeline, size_t x, size_t y)
+        {
+            {pipeline(x, y)} -> std::convertible_to<color3f>;
+        };
+
         class pipeline
         {
         public:
@@ -35,5 +44,29 @@ namespace AiCo
                 return tracer(view(x, y), sceneInsctr);
             }
         };
+
+        /**
+         * @brief Pipeline whose parts are known at compile time. Unlike simple_pipeline, no part is type erased, 
+         * so the camera, the tracer and the scene intersection can all be inlined into the renderer's per-sample loop.
+         * Use simple_pipeline when the parts are only known at runtime.
+         * The scene is not owned and must outlive the pipeline. Materials remain type erased, since they are picked per hit.
+         */
+        template<camera_like camera_type, typename tracer_type, scene_like scene_type>
+        requires tracer_like<tracer_type, scene_type>
+        class static_pipeline
+        {
+        public:
+            const scene_type& scene;
+            tracer_type tracer;
+            camera_type view;
+
+            static_pipeline(const scene_type& scene, const tracer_type& tracer, const camera_type& view) : 
+            scene(scene), tracer(tracer), view(view) {}
+
+            inline color3f operator()(size_t x, size_t y)const
+            {
+                return tracer(view(x, y), scene);
+            }
+        };
     }
 }
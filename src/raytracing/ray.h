@@ -2,15 +2,38 @@
 #include "glm/geometric.hpp"
 #include "glm/glm.hpp"
 
-namespace AiCo 
+#include <cassert>
+#include <cmath>
+
+namespace AiCo
 {
     namespace RT
     {
+        /// Tag for the ray constructor that takes a direction which is normalized already.
+        struct normalized_t{explicit normalized_t() = default;};
+        inline constexpr normalized_t NORMALIZED{};
+
+        /**
+         * @brief Ray with a unit direction. Also caches what every slab test (AABB::clip) needs: the reciprocal of the
+         * direction, and which of its components are negative. Change rays by assigning new ones so the cache follows.
+         */
         struct ray
         {
-            const glm::vec3 dir;
-            const glm::vec3 origin;
-            ray(const glm::vec3& dir, const glm::vec3& origin) : dir(glm::normalize(dir)), origin(origin) {}
+            glm::vec3 dir;
+            glm::vec3 origin;
+            /// 1/dir. Zero components give +-INF, which slab tests rely on.
+            glm::vec3 invDir;
+            /// 1 where dir is negative. Indexes the near side of the slab on that axis, 1 - sign the far side.
+            int sign[3];
+
+            ray(const glm::vec3& dir, const glm::vec3& origin) : ray(NORMALIZED, glm::normalize(dir), origin) {}
+            /// @brief Skips normalizing %dir, for directions that are unit length by construction.
+            ray(normalized_t, const glm::vec3& dir, const glm::vec3& origin) :
+            dir(dir), origin(origin), invDir(1.f/dir), sign{invDir.x < 0.f, invDir.y < 0.f, invDir.z < 0.f}
+            {
+                assert(std::abs(glm::dot(dir, dir) - 1.f) < 1e-3f);
+            }
+
             glm::vec3 at (float t)const{return t*dir + origin;}
         };
     }
@@ -1,17 +1,28 @@
 #pragma once
 
+#include "accumulation.h"
 #include "camera.h"
 #include "format.h"
+#include "image_io.h"
 #include "raster.h"
+#include "rng.h"
+#include "tonemap.h"
 #include "raytracing/tracer.h"
 #include "threadpool.h"
 #include "utils.h"
 #include "raytracing/pipeline.h"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <functional>
+#include <memory>
+#include <numeric>
+#include <span>
+#include <vector>
 
 namespace AiCo 
 {
@@ -19,61 +30,370 @@ namespace AiCo
     {
         typedef std::function<void(raster_view*)> renderer_t;
 
+        /// @brief What renderer::render_adaptive achieved. Errors are as defined by accumulation_buffer::error().
+        struct adaptive_report
+        {
+            size_t samples = 0;
+            uint passes = 0;
+            /// Over the pixels with an error, i.e. at least two samples.
+            float meanError = 0.f, maxError = 0.f;
+            /// Fraction of the pixels whose error is within the target.
+            float convergedFraction = 0.f;
+            /// Pixels that a budget under two samples per pixel left with fewer than two, and without an error.
+            size_t unmeasured = 0;
+        };
+
         class renderer
         {
-            static threadpool threads;
+            static std::unique_ptr<threadpool>& pool()
+            {
+                static std::unique_ptr<threadpool> threads = std::make_unique<threadpool>();
+                return threads;
+            }
         public:
+            /**
+             * @brief The pool renders run on, the calling thread aside. Other parallel work, like
+             * rasterizer::draw_triangles(), can run on it too, so that the process keeps to one number of threads.
+             */
+            static threadpool& threads(){return *pool();}
             uint samplesPerPixel;
             pipeline_t pipeline;
+            /// Where the camera and materials draw their sample values from, see sampler.h. Independent values if null.
+            const sampler* source = nullptr;
+
+            /**
+             * @brief Renders with %count threads from now on, the calling thread included. One hardware thread more than
+             * that by default. Must not be called while rendering.
+             */
+            static void set_thread_count(unsigned int count)
+            {
+                pool() = std::make_unique<threadpool>(std::max(count, 1u) - 1);
+            }
+            [[nodiscard]] static unsigned int thread_count(){return unsigned(threads().count()) + 1;}
 
             renderer(uint samplesPerPixel, const pipeline_t& pipeline) : samplesPerPixel(samplesPerPixel), pipeline(pipeline){}
 
-            void render(raster& image){return render(image, pipeline, samplesPerPixel);}
+            void render(raster& image){return render(image, pipeline, samplesPerPixel, source);}
+            void render(accumulation_buffer& accum){return render(accum, pipeline, samplesPerPixel, source);}
+            adaptive_report render_adaptive(accumulation_buffer& accum, float budgetSpp, float errorTarget)
+            {
+                return render_adaptive(accum, pipeline, budgetSpp, errorTarget, 8, 4, source);
+            }
 
-            static void render(raster& image, const pipeline_t& pipeline, uint samplesPerPixel)
+            /**
+             * @brief Sample number %sample of %pipeline through pixel (x, y). Its random numbers are keyed to the pixel and
+             * the sample number (see rng.h), so the result does not depend on which thread takes it or when.
+             * They come from %source, or are independent if it is null.
+             */
+            template<pipeline_like pipeline_type>
+            static color3f sample_pixel(const pipeline_type& pipeline, size_t x, size_t y, uint32_t sample, 
+            const sampler* source = nullptr)
             {
-                unsigned int count = 20*threads.count(); //experimental. Reduces cache-misses
-                
-                unsigned int nrRows = std::sqrt(count);
-                unsigned int nrCols = (count +  nrRows - 1)/nrRows;
-                
-                auto tiles = tile_raster(&image, nrRows, nrCols);
+                use_sampler(source);
+                begin_sample(pixel_id(x, y), sample);
+                return pipeline(x, y);
+            }
 
-                auto renderTile = [](raster_view tile, unsigned int samplesPerPixel, const pipeline_t& pipeline)->void
+            /**
+             * @brief Renders %image with %samplesPerPixel samples of %pipeline per pixel.
+             * Templated so that a static_pipeline is inlined into the per-sample loop, while pipeline_t still works.
+             */
+            template<pipeline_like pipeline_type>
+            static void render(raster& image, const pipeline_type& pipeline, uint samplesPerPixel, const sampler* source = nullptr)
+            {
+                for_each_tile(image.width, image.height, [&image, &pipeline, samplesPerPixel, source](tile_rect tile)
                 {
-                    for(size_t i = 0; i < tile.height; ++i)
-                        for(size_t j = 0; j < tile.width; ++j)
-                        {
-                            color3f samplesAcc = color3f{0.f, 0.f, 0.f};
+                    render_tile(span_of(image, tile), pipeline, samplesPerPixel, source);
+                });
+            }
+
+            /**
+             * @brief Renders %out.width x %out.height pixels straight into %out, with no image in memory, then finishes it.
+             *
+             * Workers take the tiles one after the other in %out's preferred order, so they complete close to that order
+             * and writers that buffer rows of tiles hold only a few at a time. Every worker writes the tiles it completes
+             * itself, so writing overlaps with the rendering of the other workers.
+             */
+            template<pipeline_like pipeline_type>
+            static void render(image_writer& out, const pipeline_type& pipeline, uint samplesPerPixel, const sampler* source = nullptr)
+            {
+                check_pixel_ids(out.width, out.height);
+                const auto tiles = square_tiles(out.width, out.height, out.tileSize, out.order);
+                std::atomic<size_t> next = 0;
+                threads().parallel_for(0, thread_count(), 1, [&](size_t)
+                {
+                    tile_buffer& local = tile_buffer::local();
+                    for(size_t t; (t = next.fetch_add(1, std::memory_order_relaxed)) < tiles.size();)
+                    {
+                        tile_span tile = local.begin(tiles[t]);
+                        shade_tile(tile, local.radiance(), pipeline, samplesPerPixel, source);
+                        out.write({tile, local.radiance()});
+                    }
+                });
+                out.finish();
+            }
+
+            /**
+             * @brief Renders the pixels of %target, the part of render(raster&, ...) that runs per tile. The pixels go to the
+             * calling thread's tile_buffer first, and to %target once the tile is done.
+             */
+            template<pipeline_like pipeline_type>
+            static void render_tile(tile_span target, const pipeline_type& pipeline, uint samplesPerPixel, 
+            const sampler* source = nullptr)
+            {
+                check_pixel_ids(size_t(target.xOffset) + target.width, size_t(target.yOffset) + target.height);
+                tile_buffer& local = tile_buffer::local();
+                tile_span tile = local.begin(target);
+                shade_tile(tile, local.radiance(), pipeline, samplesPerPixel, source);
+                local.publish();
+            }
+
+            /// @brief Tonemaps the average of every pixel of %accum into %image with %op, rows in parallel.
+            static void resolve(const accumulation_buffer& accum, raster_base& image, const tonemapper& op = tonemapper::standard())
+            {
+                assert(image.width == accum.width && image.height == accum.height);
+                tile_span pixels = image.span();
+                threads().parallel_for(0, accum.height, 16, [&accum, &pixels, &op](size_t y){accum.resolve_row(y, pixels.row(y), op);});
+            }
+
+            /**
+             * @brief Adds %samplesPerPixel samples of %pipeline to every pixel of %accum. 
+             * Repeated calls refine the same estimate, see accumulation_buffer.
+             */
+            template<pipeline_like pipeline_type>
+            static void render(accumulation_buffer& accum, const pipeline_type& pipeline, uint samplesPerPixel,
+            const sampler* source = nullptr)
+            {
+                for_each_tile(accum.width, accum.height, [&accum, &pipeline, samplesPerPixel, source](tile_rect tile)
+                {
+                    for(size_t i = tile.yOffset; i < tile.yOffset + tile.height; ++i)
+                        for(size_t j = tile.xOffset; j < tile.xOffset + tile.width; ++j)
                             for(size_t k = 0; k < samplesPerPixel; k++)
-                                samplesAcc += pipeline(j + tile.xOffset, i + tile.yOffset);
-                            tile.at(j, i) = colorftoRGBA32(gamma(1.f/samplesPerPixel * samplesAcc, 2.f));
-                        }
+                                accum.add_sample(j, i, sample_pixel(pipeline, j, i, accum.samples(j, i), source));
+                });
+            }
+
+            /**
+             * @brief Adds samples of %pipeline to %accum until every pixel's error is below %errorTarget, or until
+             * %budgetSpp samples per pixel on average have been spent.
+             *
+             * Every pixel first gets %minSamples samples, so that its variance can be estimated, or as many as the budget
+             * allows. Pixels the budget leaves with fewer than two samples have no error, see adaptive_report. The rest of
+             * the budget is spent in passes of at most %samplesPerPass samples per unconverged pixel. Each pass splits its
+             * samples between the tiles in proportion to their summed error, and within a tile the noisiest pixels are
+             * served first.
+             * Converged pixels get no more samples. Samples already in %accum count towards the error but not the budget.
+             */
+            template<pipeline_like pipeline_type>
+            static adaptive_report render_adaptive(accumulation_buffer& accum, const pipeline_type& pipeline, float budgetSpp,
+            float errorTarget, uint minSamples = 8, uint samplesPerPass = 4, const sampler* source = nullptr)
+            {
+                const auto tiles = make_tiles(accum.width, accum.height);
+                const size_t budget = size_t(budgetSpp * accum.width * accum.height);
+                minSamples = std::max(minSamples, 2u);
+
+                // error summed over the unconverged pixels of each tile, their count, and the samples granted in the pass
+                std::vector<float> tileErrors(tiles.size());
+                std::vector<uint32_t> tileActive(tiles.size());
+                std::vector<size_t> tileBudgets(tiles.size()), tileSpent(tiles.size());
+
+                auto converged = [&accum, minSamples, errorTarget](size_t x, size_t y)
+                {
+                    return accum.samples(x, y) >= minSamples && accum.error(x, y) <= errorTarget;
+                };
+                auto measure = [&](size_t t)
+                {
+                    const tile_rect& tile = tiles[t];
+                    tileErrors[t] = 0.f;
+                    tileActive[t] = 0;
+                    for(size_t i = tile.yOffset; i < tile.yOffset + tile.height; ++i)
+                        for(size_t j = tile.xOffset; j < tile.xOffset + tile.width; ++j)
+                            if(!converged(j, i))
+                            {
+                                tileErrors[t] += std::min(accum.error(j, i), 1.f);
+                                tileActive[t]++;
+                            }
                 };
-                auto renderTileTest = [&image](raster_view tile, color3f color)->void
+
+                adaptive_report report;
+
+                // initial pass, enough samples for a variance estimate. Stops early if that alone exceeds the budget
+                const uint initialSamples = std::min<size_t>(minSamples, budget / (size_t(accum.width) * accum.height));
+                for_each_tile(tiles, [&](size_t t)
                 {
-                    for(size_t i = 0; i < tile.width; ++i)
-                        for(size_t j = 0; j < tile.height; ++j)
+                    const tile_rect& tile = tiles[t];
+                    tileSpent[t] = 0;
+                    for(size_t i = tile.yOffset; i < tile.yOffset + tile.height; ++i)
+                        for(size_t j = tile.xOffset; j < tile.xOffset + tile.width; ++j)
+                            for(uint k = accum.samples(j, i); k < initialSamples; ++k, ++tileSpent[t])
+                                accum.add_sample(j, i, sample_pixel(pipeline, j, i, k, source));
+                    measure(t);
+                });
+                report.samples = std::accumulate(tileSpent.begin(), tileSpent.end(), size_t(0));
+                report.passes = 1;
+
+                std::vector<std::vector<std::pair<float, uint32_t>>> noisiest(tiles.size());
+                while(report.samples < budget)
+                {
+                    size_t active = std::accumulate(tileActive.begin(), tileActive.end(), size_t(0));
+                    float totalError = std::accumulate(tileErrors.begin(), tileErrors.end(), 0.f);
+                    if(active == 0 || totalError <= 0.f)
+                        break;
+
+                    size_t passBudget = std::min(budget - report.samples, active * samplesPerPass);
+                    size_t granted = 0;
+                    for(size_t t = 0; t < tiles.size(); ++t)
+                        granted += tileBudgets[t] = std::min(size_t(passBudget * (tileErrors[t]/totalError)),
+                        size_t(tileActive[t]) * samplesPerPass);
+                    // rounding left nothing to spend, give what is left to the noisiest tile
+                    if(granted == 0)
+                    {
+                        size_t t = std::max_element(tileErrors.begin(), tileErrors.end()) - tileErrors.begin();
+                        tileBudgets[t] = std::min<size_t>(passBudget, size_t(tileActive[t]) * samplesPerPass);
+                    }
+
+                    for_each_tile(tiles, [&](size_t t)
+                    {
+                        const tile_rect& tile = tiles[t];
+                        tileSpent[t] = 0;
+                        if(tileBudgets[t] == 0)
+                            return;
+
+                        auto& pixels = noisiest[t];
+                        pixels.clear();
+                        for(uint32_t i = 0; i < tile.height; ++i)
+                            for(uint32_t j = 0; j < tile.width; ++j)
+                                if(!converged(j + tile.xOffset, i + tile.yOffset))
+                                    pixels.push_back({accum.error(j + tile.xOffset, i + tile.yOffset), i*tile.width + j});
+                        std::sort(pixels.begin(), pixels.end(), std::greater<>());
+
+                        // even share for every unconverged pixel, the remainder goes to the noisiest ones
+                        size_t share = tileBudgets[t]/pixels.size(), remainder = tileBudgets[t] % pixels.size();
+                        for(size_t p = 0; p < pixels.size(); ++p)
                         {
-                            if (&tile.at(i, j) != &image.at(i + tile.xOffset, j + tile.yOffset))
-                                printf("Indexing Mismatch! Local: (%zu, %zu), Global: (%lu, %lu), Offset : (%u, %u)\n", i, j, 
-                                i + tile.xOffset, j + tile.yOffset, tile.xOffset, tile.yOffset);
-                            tile.at(i, j) = colorftoRGBA32(gamma(color, 2.f));
+                            size_t x = pixels[p].second % tile.width + tile.xOffset, y = pixels[p].second / tile.width + tile.yOffset;
+                            for(size_t k = 0; k < share + (p < remainder); ++k, ++tileSpent[t])
+                                accum.add_sample(x, y, sample_pixel(pipeline, x, y, accum.samples(x, y), source));
                         }
+                        measure(t);
+                    });
+
+                    size_t spent = std::accumulate(tileSpent.begin(), tileSpent.end(), size_t(0));
+                    if(spent == 0)
+                        break;
+                    report.samples += spent;
+                    report.passes++;
+                }
+
+                struct error_stats
+                {
+                    size_t converged = 0, unmeasured = 0;
+                    double sum = 0.0;
+                    float max = 0.f;
                 };
-                
-                //TODO why is taking tile by reference wrong here?
-                for (auto tile : tiles)
-                    threads.enqueue_job([tile, &pipeline, samplesPerPixel, renderTile](){renderTile(tile, samplesPerPixel, pipeline);});
-                
-                threads.wait_till_done();
+                auto stats = threads().parallel_reduce(0, accum.height, 16, error_stats{}, [&](size_t y)
+                {
+                    error_stats row;
+                    for(int x = 0; x < accum.width; ++x)
+                    {
+                        // the error of fewer than two samples is INF, which would swamp the others
+                        if(accum.samples(x, y) < 2)
+                        {
+                            row.unmeasured++;
+                            continue;
+                        }
+                        float error = accum.error(x, y);
+                        row.converged += converged(x, y);
+                        row.sum += error;
+                        row.max = std::max(row.max, error);
+                    }
+                    return row;
+                }, 
+                [](const error_stats& a, const error_stats& b)
+                {
+                    return error_stats{a.converged + b.converged, a.unmeasured + b.unmeasured, a.sum + b.sum, 
+                    std::max(a.max, b.max)};
+                });
+                const size_t pixels = size_t(accum.width) * accum.height, measured = pixels - stats.unmeasured;
+                report.unmeasured = stats.unmeasured;
+                report.maxError = stats.max;
+                report.meanError = measured == 0 ? 0.f : float(stats.sum/measured);
+                report.convergedFraction = pixels == 0 ? 1.f : float(stats.converged)/pixels;
+                return report;
+            }
+
+            /// Side of the tiles make_tiles() aims for. Small enough to keep a tile's working set in cache.
+            static constexpr unsigned int TILE_SIZE = 32;
+            /// Smallest side make_tiles() shrinks tiles to on small images.
+            static constexpr unsigned int MIN_TILE_SIZE = 8;
+
+            /**
+             * @brief Splits a %width x %height image into %tileSize x %tileSize tiles ordered along a Hilbert curve, so
+             * tiles next to each other in the list are next to each other in the image. No frame time gain over scanline
+             * order has been measured, see tile_order_bench. Tiles shrink, down to MIN_TILE_SIZE, while there are fewer
+             * than two per worker.
+             *
+             * for_each_tile() hands the tiles to parallel_for, which splits the range in halves and lets idle workers steal
+             * the larger halves, so every worker renders contiguous runs of the curve.
+             */
+            static std::vector<tile_rect> make_tiles(unsigned int width, unsigned int height, unsigned int tileSize = TILE_SIZE,
+            tile_order order = tile_order::hilbert)
+            {
+                check_pixel_ids(width, height);
+                auto count = [width, height](unsigned int size){return size_t((width + size - 1)/size) * ((height + size - 1)/size);};
+                while(tileSize > MIN_TILE_SIZE && count(tileSize) < 2 * thread_count())
+                    tileSize /= 2;
+                return square_tiles(width, height, std::max(tileSize, 1u), order);
+            }
+
+            /**
+             * @brief Splits a %width x %height image with make_tiles() and calls %tileFn(tile_rect) on every tile in parallel.
+             * Returns once all tiles are done.
+             */
+            template<typename tile_fn>
+            static void for_each_tile(unsigned int width, unsigned int height, const tile_fn& tileFn)
+            {
+                auto tiles = make_tiles(width, height);
+                threads().parallel_for(0, tiles.size(), 1, [&tiles, &tileFn](size_t t){tileFn(tiles[t]);});
+            }
+            /**
+             * @brief Calls %tileFn(size_t tileIdx) for the index of every tile in %tiles in parallel.
+             * Returns once all tiles are done.
+             */
+            template<typename tile_fn>
+            static void for_each_tile(const std::vector<tile_rect>& tiles, const tile_fn& tileFn)
+            {
+                threads().parallel_for(0, tiles.size(), 1, tileFn);
             }
             
             void operator()(raster& image)
             {
                 render(image);
             }
+            void operator()(accumulation_buffer& accum)
+            {
+                render(accum);
+            }
+
+        private:
+            /// @brief Writes the average of %samplesPerPixel samples of every pixel of %tile to %radiance, and tonemapped to %tile.
+            template<pipeline_like pipeline_type>
+            static void shade_tile(const tile_span& tile, std::span<color3f> radiance, const pipeline_type& pipeline,
+            uint samplesPerPixel, const sampler* source)
+            {
+                const float scale = 1.f/samplesPerPixel;
+                for(size_t i = 0; i < tile.height; ++i)
+                {
+                    for(size_t j = 0; j < tile.width; ++j)
+                    {
+                        color3f samplesAcc = color3f{0.f, 0.f, 0.f};
+                        for(size_t k = 0; k < samplesPerPixel; k++)
+                            samplesAcc += sample_pixel(pipeline, j + tile.xOffset, i + tile.yOffset, k, source);
+                        radiance[i*tile.width + j] = samplesAcc * scale;
+                    }
+                    tonemapper::standard()(&radiance[i*tile.width], tile.width, tile.row(i).data());
+                }
+            }
         };
-        inline threadpool renderer::threads = threadpool();
     }
 }
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "aligned.h"
+#include "interval.h"
+#include "metrics.h"
+#include "simd.h"
+#include "raytracing/bvh.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/ray.h"
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <vector>
+
+namespace AiCo
+{
+    namespace RT
+    {
+        /**
+         * @brief Spheres stored as a structure of arrays, intersected simd::WIDTH at a time.
+         * Every array is followed by simd::WIDTH padding spheres with a NaN radius, which never intersect anything.
+         * This lets the kernel load full vectors at any offset, so ranges need not be aligned to the vector width.
+         */
+        class sphere_soa final : public bounded_geometry
+        {
+        public:
+            sphere_soa() {pad();}
+
+            inline size_t size()const{return count;}
+
+            void reserve(size_t n)
+            {
+                for(auto array : {&cx, &cy, &cz, &radii})
+                    array->reserve(n + simd::WIDTH);
+                matIndices.reserve(n + simd::WIDTH);
+            }
+
+            void add(float radius, const glm::vec3& center, const material_t& mat)
+            {
+                uint32_t matIdx = 0;
+                while(matIdx < materials.size() && materials[matIdx] != &mat)
+                    matIdx++;
+                if(matIdx == materials.size())
+                    materials.push_back(&mat);
+
+                // overwrite the first padding sphere and append a new one
+                cx[count] = center.x; cy[count] = center.y; cz[count] = center.z;
+                radii[count] = radius;
+                matIndices[count] = matIdx;
+                count++;
+                push_padding();
+            }
+
+            [[nodiscard]] inline glm::vec3 center(size_t idx)const{assert(idx < count); return {cx[idx], cy[idx], cz[idx]};}
+            [[nodiscard]] inline float radius(size_t idx)const{assert(idx < count); return radii[idx];}
+            [[nodiscard]] inline const material_t& material(size_t idx)const{assert(idx < count); return *materials[matIndices[idx]];}
+
+            [[nodiscard]] inline AABB bounds(size_t idx)const
+            {
+                glm::vec3 extent(std::abs(radius(idx)));
+                return {center(idx) - extent, center(idx) + extent};
+            }
+            [[nodiscard]] virtual AABB bounds()const override
+            {
+                AABB result;
+                for(size_t i = 0; i < count; ++i)
+                    result.expand(bounds(i));
+                return result;
+            }
+
+            /**
+             * @brief Reorders the spheres so that the sphere previously at order[i] ends up at i.
+             */
+            void permute(const std::vector<uint32_t>& order)
+            {
+                assert(order.size() == count);
+                auto permuteArray = [&order, this](auto& array)
+                {
+                    auto copy = array;
+                    for(size_t i = 0; i < count; ++i)
+                        array[i] = copy[order[i]];
+                };
+                permuteArray(cx); permuteArray(cy); permuteArray(cz); permuteArray(radii); permuteArray(matIndices);
+            }
+
+            /**
+             * @brief Nearest intersection of %R with the spheres [first, first + n) within %K. %prim of the result is the
+             * index of the sphere.
+             * @warning Assumes %R.dir is normalized, which ray guarantees.
+             */
+            [[nodiscard]] std::optional<hit_record> nearest(const ray& R, interval K, size_t first, size_t n)const
+            {
+                assert(first + n <= count);
+                using namespace simd;
+
+                const vfloat ox = set1(R.origin.x), oy = set1(R.origin.y), oz = set1(R.origin.z);
+                const vfloat dx = set1(R.dir.x), dy = set1(R.dir.y), dz = set1(R.dir.z);
+                const vfloat tMin = set1(K.min), zero = set1(0.f);
+
+                vfloat bestT = set1(K.max);
+                vint bestIdx = set1(int32_t(-1));
+                vint idx = iota() + set1(int32_t(first));
+                const vint step = set1(int32_t(WIDTH));
+
+                const size_t end = first + n;
+                for(size_t i = first; i < end; i += WIDTH, idx = idx + step)
+                {
+                    vfloat ocx = loadu(&cx[i]) - ox, ocy = loadu(&cy[i]) - oy, ocz = loadu(&cz[i]) - oz;
+                    vfloat r = loadu(&radii[i]);
+
+                    vfloat h = fmadd(dx, ocx, fmadd(dy, ocy, dz * ocz));
+                    vfloat c = fmadd(ocx, ocx, fmadd(ocy, ocy, fmadd(ocz, ocz, zero - r * r)));
+                    vfloat discriminant = h * h - c;
+
+                    vmask valid = (discriminant >= zero) & lanes_below(end - i);
+                    if(!any(valid))
+                        continue;
+
+                    vfloat sqrtd = sqrt(max(discriminant, zero));
+                    vfloat nearRoot = h - sqrtd, farRoot = h + sqrtd;
+
+                    vmask nearInside = (nearRoot >= tMin) & (nearRoot <= bestT);
+                    vmask farInside = (farRoot >= tMin) & (farRoot <= bestT);
+                    vmask hit = valid & (nearInside | farInside);
+
+                    bestT = select(hit, select(nearInside, nearRoot, farRoot), bestT);
+                    bestIdx = select(hit, idx, bestIdx);
+                }
+
+                alignas(64) float ts[WIDTH];
+                alignas(64) int32_t indices[WIDTH];
+                storeu(ts, bestT);
+                storeu(indices, bestIdx);
+
+                std::optional<hit_record> result = {};
+                float closest = K.max;
+                for(size_t lane = 0; lane < WIDTH; ++lane)
+                    if(indices[lane] >= 0 && ts[lane] <= closest)
+                    {
+                        closest = ts[lane];
+                        result = hit_record{ts[lane], uint32_t(indices[lane]), glm::vec2(0.f), this};
+                    }
+                return result;
+            }
+
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const override
+            {
+                count_intersect(count);
+                return nearest(R, K, 0, count);
+            }
+
+            [[nodiscard]] virtual intersection_t resolve(const ray& R, const hit_record& record)const override
+            {
+                glm::vec3 P = R.at(record.t);
+                glm::vec3 N = (P - center(record.prim))/radius(record.prim);
+                return intersection_t(R, N, P, record.t, sphere::surface_coords(N), material(record.prim));
+            }
+
+        private:
+            size_t count = 0;
+            aligned_vector<float> cx, cy, cz, radii;
+            aligned_vector<uint32_t> matIndices;
+            std::vector<const material_t*> materials;
+
+            void push_padding()
+            {
+                cx.push_back(0.f); cy.push_back(0.f); cz.push_back(0.f);
+                radii.push_back(std::numeric_limits<float>::quiet_NaN());
+                matIndices.push_back(0);
+            }
+            void pad()
+            {
+                for(size_t i = 0; i < simd::WIDTH; ++i)
+                    push_padding();
+            }
+        };
+
+        /**
+         * @brief BVH whose leaves are runs of a sphere_soa, tested with one SIMD batch per leaf.
+         * The spheres are copied and reordered so every leaf is contiguous.
+         */
+        class sphere_bvh final : public bounded_geometry
+        {
+        public:
+            sphere_bvh(const sphere_soa& spheres) : spheres(spheres)
+            {
+                std::vector<AABB> primBounds;
+                primBounds.reserve(spheres.size());
+                for(size_t i = 0; i < spheres.size(); ++i)
+                    primBounds.push_back(spheres.bounds(i));
+
+                tree.maxLeafSize = uint32_t(simd::WIDTH);
+                tree.build(primBounds);
+                this->spheres.permute(tree.primIndices);
+            }
+
+            /// @brief Nearest hit among the spheres. Records are owned, and resolved, by the reordered sphere_soa.
+            [[nodiscard]] virtual std::optional<hit_record> hit(const ray& R, interval K)const override
+            {
+                std::optional<hit_record> result = {};
+                // leaves index primIndices, which the permutation turned into the identity on spheres
+                tree.traverse(R, K, [this, &R, &result](uint32_t first, uint32_t count, interval K) -> float
+                {
+                    count_intersect(count);
+                    if(auto record = spheres.nearest(R, K, first, count); record.has_value())
+                    {
+                        result = record;
+                        return record->t;
+                    }
+                    return K.max;
+                });
+                return result;
+            }
+
+            [[nodiscard]] virtual AABB bounds()const override
+            {
+                return tree.nodes.empty() ? AABB() : tree.nodes[0].bounds;
+            }
+
+        private:
+            sphere_soa spheres;
+            bvh_tree tree;
+        };
+    }
+}
@@ -6,7 +6,10 @@
 #include "geometry.h"
 #include "raytracing/intersection.h"
 #include "raytracing/ray.h"
+#include "metrics.h"
 
+#include <algorithm>
+#include <concepts>
 #include <functional>
 
 namespace AiCo 
@@ -15,6 +18,13 @@ namespace AiCo
     {
         typedef std::function<color3f(ray, const intersector_t&)> tracer_t;
 
+        /// Anything that computes the radiance along a ray through %scene_type.
+        template<typename T, typename scene_type>
+        concept tracer_like = requires(const T& tracer, ray R, const scene_type& scene)
+        {
+            {tracer(R, scene)} -> std::convertible_to<color3f>;
+        };
+
         class tracer
         {
         public:
@@ -31,6 +41,26 @@ namespace AiCo
             return AiCo::lerp(0.5 * sample.dir.y + 0.5, blue, white);
         };
 
+        /// @brief Radiance arriving along rays that escape the scene.
+        inline color3f background(const ray& R){return 0.8f * rayGradient(R);}
+
+        /**
+         * @brief Russian roulette. Once a path is %rouletteDepth bounces deep, it survives with a probability equal to its
+         * brightest throughput channel, and survivors are reweighted by the inverse of that probability.
+         * Dark paths are cut early while the estimate stays unbiased.
+         * @return false if the path is terminated.
+         */
+        [[nodiscard]] inline bool survives_roulette(color3f& throughput, uint depth, uint rouletteDepth)
+        {
+            if(depth < rouletteDepth)
+                return true;
+            float survival = std::min(1.f, std::max(throughput.r, std::max(throughput.g, throughput.b)));
+            if(AiCo::rand() >= survival)
+                return false;
+            throughput /= survival;
+            return true;
+        }
+
         inline auto normalTracer = [](const ray& R, interval K, const intersector_t& insctr)->color3f
         {
             if(auto insct = insctr(R, K); insct.has_value())
@@ -43,33 +73,51 @@ namespace AiCo
         {
         public:
             uint maxDepth;
+            /// Paths are never terminated by russian roulette before this many bounces.
+            uint rouletteDepth;
             
             interval K;
 
-            unbiased_tracer(uint maxDepth, interval rayBounds) : maxDepth(maxDepth), K(rayBounds) {}
+            unbiased_tracer(uint maxDepth, interval rayBounds, uint rouletteDepth = 3) : 
+            maxDepth(maxDepth), rouletteDepth(rouletteDepth), K(rayBounds) {}
 
             inline virtual color3f operator()(ray R, const intersector_t& insctr)const override
             {
-                uint currentDepth = 0; 
-                return trace(R, currentDepth, insctr, K);
+                return trace(R, insctr, K);
+            }
+            /// @brief Overload for concrete scene types, which lets static_pipeline inline the scene intersection.
+            template<scene_like scene_type>
+            inline color3f operator()(ray R, const scene_type& scene)const
+            {
+                return trace(R, scene, K);
             }
         private:
-            inline color3f trace(ray R, uint currentDepth, const intersector_t& intersector, interval K)const
+            template<typename scene_type>
+            inline color3f trace(ray R, const scene_type& intersector, interval K)const
             {
-                if(currentDepth >= maxDepth)
-                    return {0.f, 0.f, 0.f};
-                
-                //TODO early termination for low energy rays?
-                
-                if(auto insct = intersector(R, K); insct.has_value())
+                color3f throughput{1.f, 1.f, 1.f};
+                ray current = R;
+
+                for(uint depth = 0; depth < maxDepth; ++depth)
                 {
-                    if(auto scatterinfo = insct->mat.scatter(*insct); scatterinfo.has_value())
-                        return insct->mat.texture(*insct) * trace(scatterinfo->out, ++currentDepth, intersector, K);
-                    else
-                        return insct->mat.texture(*insct);
+                    count_path_depth(depth);
+
+                    auto insct = intersector(current, K);
+                    if(!insct.has_value())
+                        return throughput * background(current);
+
+                    begin_bounce(depth + 1);
+                    auto scatterinfo = insct->mat->scatter(*insct);
+                    if(!scatterinfo.has_value())
+                        return throughput * insct->mat->texture(*insct);
+
+                    throughput *= insct->mat->texture(*insct);
+                    if(!survives_roulette(throughput, depth + 1, rouletteDepth))
+                        return {0.f, 0.f, 0.f};
+
+                    current = scatterinfo->out;
                 }
-                else
-                    return 0.8f * rayGradient(R);
+                return {0.f, 0.f, 0.f};
             }
         };
     }
@@ -0,0 +1,203 @@
+#pragma once
+
+#include "format.h"
+#include "interval.h"
+#include "raster.h"
+#include "rng.h"
+#include "tonemap.h"
+#include "utils.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/ray.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
+
+namespace AiCo
+{
+    namespace RT
+    {
+        /**
+         * @brief Iterative path tracer that advances a whole batch of paths one bounce at a time, instead of following one
+         * path to the end before starting the next.
+         *
+         * Every bounce runs in three stages over the batch: extend intersects every ray with the scene, shade groups the
+         * hits by material and scatters each group in one run, and compaction keeps the surviving paths for the next bounce.
+         * Produces the same estimate as unbiased_tracer, including its russian roulette. Every path carries its pixel and
+         * sample number, so it draws the same random numbers it would in unbiased_tracer.
+         */
+        class wavefront_tracer
+        {
+        public:
+            uint maxDepth;
+            /// See unbiased_tracer::rouletteDepth.
+            uint rouletteDepth;
+            interval K;
+            /// Number of paths in flight per batch. Large enough to amortize the stages, small enough to stay in cache.
+            size_t batchSize;
+            /// See renderer::source.
+            const sampler* source = nullptr;
+
+            wavefront_tracer(uint maxDepth, interval rayBounds, size_t batchSize = 1 << 14, uint rouletteDepth = 3) :
+            maxDepth(maxDepth), rouletteDepth(rouletteDepth), K(rayBounds), batchSize(batchSize) {}
+
+            /**
+             * @brief Renders %samplesPerPixel samples for every pixel of %target and writes the gamma corrected average.
+             * Radiance is summed and pixels are written in the calling thread's tile_buffer, which is published to %target.
+             */
+            template<camera_like camera_type, scene_like scene_type>
+            void render_tile(tile_span target, const camera_type& view, const scene_type& scene, uint samplesPerPixel)const
+            {
+                check_pixel_ids(size_t(target.xOffset) + target.width, size_t(target.yOffset) + target.height);
+                tile_buffer& local = tile_buffer::local();
+                const tile_span tile = local.begin(target);
+                const size_t pixels = size_t(tile.width) * tile.height;
+                const size_t total = pixels * samplesPerPixel;
+
+                std::span<color3f> radiance = local.radiance();
+                std::fill(radiance.begin(), radiance.end(), color3f(0.f));
+                ray_batch paths, survivors;
+                std::vector<std::optional<intersection_t>> hits;
+                std::vector<std::pair<const material_t*, uint32_t>> order;
+
+                use_sampler(source);
+                for(size_t begin = 0; begin < total; begin += batchSize)
+                {
+                    const size_t end = std::min(total, begin + batchSize);
+
+                    // generate. consecutive paths go through neighbouring pixels, so the first bounces stay coherent
+                    paths.clear();
+                    for(size_t s = begin; s < end; ++s)
+                    {
+                        uint32_t px = uint32_t(s % pixels), sample = uint32_t(s / pixels);
+                        uint32_t id = pixel_id(px % tile.width + tile.xOffset, px / tile.width + tile.yOffset);
+                        begin_sample(id, sample);
+                        ray R = view(px % tile.width + tile.xOffset, px / tile.width + tile.yOffset);
+                        paths.push(R.origin, R.dir, color3f(1.f), px, id, sample);
+                    }
+
+                    for(uint depth = 0; depth < maxDepth && paths.size() != 0; ++depth)
+                    {
+                        extend(paths, scene, hits, depth);
+                        shade(paths, hits, order, survivors, radiance, depth);
+                        std::swap(paths, survivors);
+                    }
+                    // paths still alive at maxDepth contribute nothing, like in unbiased_tracer
+                }
+
+                for(size_t i = 0; i < tile.height; ++i)
+                    tonemapper::standard()(&radiance[i*tile.width], tile.width, tile.row(i).data(), 1.f/samplesPerPixel);
+                local.publish();
+            }
+
+        private:
+            struct ray_batch
+            {
+                std::vector<glm::vec3> origins, dirs;
+                std::vector<color3f> throughputs;
+                /// Index into the tile's radiance, and the pixel_id() and sample number the path's random numbers are keyed to.
+                std::vector<uint32_t> pixels, ids, samples;
+
+                inline size_t size()const{return pixels.size();}
+                inline void clear()
+                {
+                    origins.clear(); dirs.clear(); throughputs.clear(); pixels.clear(); ids.clear(); samples.clear();
+                }
+                inline void push(const glm::vec3& origin, const glm::vec3& dir, const color3f& throughput, uint32_t pixel,
+                uint32_t id, uint32_t sample)
+                {
+                    origins.push_back(origin); dirs.push_back(dir); throughputs.push_back(throughput); pixels.push_back(pixel);
+                    ids.push_back(id); samples.push_back(sample);
+                }
+            };
+
+            template<scene_like scene_type>
+            inline void extend(const ray_batch& paths, const scene_type& scene, std::vector<std::optional<intersection_t>>& hits, 
+            uint depth)const
+            {
+                hits.clear();
+                hits.reserve(paths.size());
+                for(size_t i = 0; i < paths.size(); ++i)
+                {
+                    count_path_depth(depth);
+                    hits.push_back(scene(ray(NORMALIZED, paths.dirs[i], paths.origins[i]), K));
+                }
+            }
+
+            /**
+             * @brief Terminates escaped and absorbed paths into %radiance and writes the scattered ones to %survivors.
+             * Hits are processed in runs of the same material, so each material's scatter and texture code stays hot.
+             */
+            inline void shade(const ray_batch& paths, const std::vector<std::optional<intersection_t>>& hits,
+            std::vector<std::pair<const material_t*, uint32_t>>& order, ray_batch& survivors, std::span<color3f> radiance, 
+            uint depth)const
+            {
+                order.clear();
+                for(uint32_t i = 0; i < paths.size(); ++i)
+                    if(hits[i].has_value())
+                        order.push_back({hits[i]->mat, i});
+                    else
+                        radiance[paths.pixels[i]] += paths.throughputs[i] * 
+                        background(ray(NORMALIZED, paths.dirs[i], paths.origins[i]));
+
+                // sorting by (material, index) keeps the paths of one material in their original order
+                std::sort(order.begin(), order.end());
+
+                survivors.clear();
+                for(const auto& [mat, i] : order)
+                {
+                    const intersection_t& insct = *hits[i];
+                    color3f albedo = mat->texture(insct);
+                    begin_sample(paths.ids[i], paths.samples[i], depth + 1);
+                    if(auto scatterinfo = mat->scatter(insct); scatterinfo.has_value())
+                    {
+                        color3f throughput = paths.throughputs[i] * albedo;
+                        if(survives_roulette(throughput, depth + 1, rouletteDepth))
+                            survivors.push(scatterinfo->out.origin, scatterinfo->out.dir, throughput, paths.pixels[i],
+                            paths.ids[i], paths.samples[i]);
+                    }
+                    else
+                        radiance[paths.pixels[i]] += paths.throughputs[i] * albedo;
+                }
+            }
+        };
+
+        /**
+         * @brief Renders a scene with a wavefront_tracer, one batch of paths per tile and worker.
+         * The scene is not owned and must outlive the renderer.
+         */
+        template<camera_like camera_type, scene_like scene_type>
+        class wavefront_renderer
+        {
+        public:
+            uint samplesPerPixel;
+            const scene_type& scene;
+            wavefront_tracer tracer;
+            camera_type view;
+
+            wavefront_renderer(uint samplesPerPixel, const scene_type& scene, const wavefront_tracer& tracer, const camera_type& view) :
+            samplesPerPixel(samplesPerPixel), scene(scene), tracer(tracer), view(view) {}
+
+            void render(raster& image)
+            {
+                renderer::for_each_tile(image.width, image.height, [this, &image](tile_rect tile)
+                {
+                    tracer.render_tile(span_of(image, tile), view, scene, samplesPerPixel);
+                });
+            }
+
+            void operator()(raster& image)
+            {
+                render(image);
+            }
+        };
+    }
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include "simd.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+/**
+ * Counter-based random numbers. Instead of advancing a generator's state, every random number is a hash of the
+ * coordinates it is drawn for: the pixel, the sample index, the bounce of the path and the dimension within that
+ * bounce. A sample then sees the same numbers whichever thread renders it and in whichever order, so images are
+ * bit-identical for any thread count or tile order, and the hash vectorizes like any other arithmetic.
+ */
+namespace AiCo
+{
+    /**
+     * @brief Jarzynski and Olano's pcg4d, "Hash Functions for GPU Rendering" (JCGT 2020). Mixes all four inputs into
+     * all four outputs with an LCG step and two rounds of multiplications across the lanes.
+     */
+    inline void pcg4d(uint32_t& x, uint32_t& y, uint32_t& z, uint32_t& w)
+    {
+        x = x * 1664525u + 1013904223u; y = y * 1664525u + 1013904223u;
+        z = z * 1664525u + 1013904223u; w = w * 1664525u + 1013904223u;
+        x += y * w; y += z * x; z += x * y; w += y * z;
+        x ^= x >> 16; y ^= y >> 16; z ^= z >> 16; w ^= w >> 16;
+        x += y * w; y += z * x; z += x * y; w += y * z;
+    }
+    inline void pcg4d(simd::vint& x, simd::vint& y, simd::vint& z, simd::vint& w)
+    {
+        using namespace simd;
+        const vint mul = set1(1664525), inc = set1(1013904223);
+        x = x * mul + inc; y = y * mul + inc; z = z * mul + inc; w = w * mul + inc;
+        x += y * w; y += z * x; z += x * y; w += y * z;
+        x ^= x >> 16; y ^= y >> 16; z ^= z >> 16; w ^= w >> 16;
+        x += y * w; y += z * x; z += x * y; w += y * z;
+    }
+
+    /// @return %bits mapped to [0, 1). The top 24 bits fill the float's mantissa exactly.
+    [[nodiscard]] inline float to_unit_float(uint32_t bits){return float(bits >> 8) * 0x1p-24f;}
+    [[nodiscard]] inline simd::vfloat to_unit_float(simd::vint bits){return simd::to_float(bits >> 8) * simd::set1(0x1p-24f);}
+
+    /// Pixel coordinates must be below this to fit pixel_id(), or pixels would share their random numbers.
+    constexpr size_t PIXEL_ID_LIMIT = 1 << 16;
+
+    /// @return 32 bit pixel key for the counters. See check_pixel_ids().
+    [[nodiscard]] constexpr uint32_t pixel_id(size_t x, size_t y)
+    {
+        assert(x < PIXEL_ID_LIMIT && y < PIXEL_ID_LIMIT);
+        return uint32_t(y) << 16 | uint32_t(x);
+    }
+    /// @brief Throws std::runtime_error unless every pixel of a %width x %height image has a pixel_id() of its own.
+    inline void check_pixel_ids(size_t width, size_t height)
+    {
+        if(width > PIXEL_ID_LIMIT || height > PIXEL_ID_LIMIT)
+            throw std::runtime_error("image too large for pixel_id(), width and height must be at most 65536");
+    }
+
+    /**
+     * @brief Uniform number in [0, 1) for dimension %dim of bounce %bounce of sample %sample through %pixel.
+     * Different %seed values give independent images. Bounces must fit in the low 16 bits, seeds in the high 16.
+     */
+    [[nodiscard]] inline float counter_rand(uint32_t pixel, uint32_t sample, uint32_t bounce, uint32_t dim, uint32_t seed = 0)
+    {
+        uint32_t x = pixel, y = sample, z = dim, w = seed << 16 | bounce;
+        pcg4d(x, y, z, w);
+        return to_unit_float(x);
+    }
+    /// @brief Batch counter_rand(). %out[i] is counter_rand(%pixel, %firstSample + i, %bounce, %dim, %seed) for i in [0, %n).
+    inline void counter_rand(size_t n, uint32_t pixel, uint32_t firstSample, uint32_t bounce, uint32_t dim, uint32_t seed,
+    float* out)
+    {
+        using namespace simd;
+        size_t i = 0;
+        for(; i + WIDTH <= n; i += WIDTH)
+        {
+            vint x = set1(int32_t(pixel)), y = set1(int32_t(firstSample + i)) + iota();
+            vint z = set1(int32_t(dim)), w = set1(int32_t(seed << 16 | bounce));
+            pcg4d(x, y, z, w);
+            storeu(out + i, to_unit_float(x));
+        }
+        for(; i < n; ++i)
+            out[i] = counter_rand(pixel, uint32_t(firstSample + i), bounce, dim, seed);
+    }
+
+    /// Dimensions reserved per bounce. Bounce b draws dimensions [b * BOUNCE_DIMENSIONS, (b + 1) * BOUNCE_DIMENSIONS).
+    constexpr uint32_t BOUNCE_DIMENSIONS = 8;
+
+    /**
+     * @brief Source of the sample values of every (pixel, sample, dimension). Dimensions are consumed in pairs by the 2d
+     * mappings of sampling.h, so samplers that stratify do so over consecutive pairs (2k, 2k + 1). See sampler.h.
+     */
+    class sampler
+    {
+    public:
+        /// @return Value in [0, 1) of dimension %dim of sample %sample through pixel %pixel.
+        [[nodiscard]] virtual float operator()(uint32_t pixel, uint32_t sample, uint32_t dim)const = 0;
+        virtual ~sampler() = default;
+    };
+
+    /**
+     * @brief The counters AiCo::rand() draws from on this thread. Renderers start every sample with begin_sample(),
+     * tracers start every bounce with begin_bounce(), and each draw takes the next dimension.
+     * Outside of a render the defaults give an ordinary stream of numbers per thread, see thread_stream().
+     */
+    struct sample_context
+    {
+        uint32_t pixel = 0, sample = 0, bounce = 0, dim = 0;
+        uint32_t seed = 0;
+        /// Draws come from counter_rand() when null, and dimensions past a bounce's BOUNCE_DIMENSIONS always do.
+        const sampler* source = nullptr;
+    };
+    /**
+     * @return The counters of a thread that has not begun a sample: a pixel key of its own, numbered in the order
+     * threads first draw, and a sample number no render reaches.
+     */
+    inline sample_context thread_stream()
+    {
+        static std::atomic<uint32_t> nextThread = 0;
+        return {.pixel = nextThread.fetch_add(1, std::memory_order_relaxed), .sample = UINT32_MAX};
+    }
+    inline thread_local sample_context SAMPLE_CONTEXT = thread_stream();
+
+    /// @brief Makes the following samples on this thread draw from %source, or from counter_rand() if it is null.
+    inline void use_sampler(const sampler* source){SAMPLE_CONTEXT.source = source;}
+
+    inline void begin_sample(uint32_t pixel, uint32_t sample, uint32_t bounce = 0)
+    {
+        SAMPLE_CONTEXT.pixel = pixel;
+        SAMPLE_CONTEXT.sample = sample;
+        SAMPLE_CONTEXT.bounce = bounce;
+        SAMPLE_CONTEXT.dim = 0;
+    }
+    inline void begin_bounce(uint32_t bounce)
+    {
+        SAMPLE_CONTEXT.bounce = bounce;
+        SAMPLE_CONTEXT.dim = 0;
+    }
+    /// @return The next dimension of the current sample and bounce.
+    [[nodiscard]] inline float next_rand()
+    {
+        auto& ctx = SAMPLE_CONTEXT;
+        uint32_t dim = ctx.dim++;
+        if(ctx.source != nullptr && dim < BOUNCE_DIMENSIONS)
+            return (*ctx.source)(ctx.pixel, ctx.sample, ctx.bounce * BOUNCE_DIMENSIONS + dim);
+        return counter_rand(ctx.pixel, ctx.sample, ctx.bounce, dim, ctx.seed);
+    }
+}
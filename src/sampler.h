@@ -0,0 +1,276 @@
+#pragma once
+
+#include "rng.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * Samplers that choose the values every (pixel, sample, dimension) draws, see AiCo::sampler. The stratified and
+ * low-discrepancy ones spread the samples of a pixel evenly over each pair of dimensions, which lowers the error at a
+ * given sample count below that of independent samples.
+ */
+namespace AiCo
+{
+    /// @return %x with its bits in reverse order.
+    [[nodiscard]] constexpr uint32_t reverse_bits(uint32_t x)
+    {
+        x = (x << 16) | (x >> 16);
+        x = ((x & 0x00ff00ffu) << 8) | ((x & 0xff00ff00u) >> 8);
+        x = ((x & 0x0f0f0f0fu) << 4) | ((x & 0xf0f0f0f0u) >> 4);
+        x = ((x & 0x33333333u) << 2) | ((x & 0xccccccccu) >> 2);
+        x = ((x & 0x55555555u) << 1) | ((x & 0xaaaaaaaau) >> 1);
+        return x;
+    }
+
+    /// @brief Burley's Laine-Karras style hash: every bit of the result only depends on the bits below it in %x.
+    [[nodiscard]] constexpr uint32_t laine_karras_permutation(uint32_t x, uint32_t seed)
+    {
+        x ^= x * 0x3d20adeau;
+        x += seed;
+        x *= (seed >> 16) | 1u;
+        x ^= x * 0x05526c56u;
+        x ^= x * 0x53a22864u;
+        return x;
+    }
+    /**
+     * @brief Owen scrambling of the bits of %x, read from the most significant one, by a random tree of flips keyed by
+     * %seed. Burley, "Practical Hash-based Owen Scrambling" (JCGT 2020).
+     */
+    [[nodiscard]] constexpr uint32_t nested_uniform_scramble(uint32_t x, uint32_t seed)
+    {
+        return reverse_bits(laine_karras_permutation(reverse_bits(x), seed));
+    }
+
+    /**
+     * @brief Second dimension of the Sobol sequence, the image of %index by the Pascal matrix. The first is the van der
+     * Corput sequence, reverse_bits(%index). The matrix is linear over xor, so this is the xor of one table entry per byte.
+     */
+    [[nodiscard]] inline uint32_t sobol_pascal(uint32_t index)
+    {
+        static constexpr auto TABLES = []
+        {
+            std::array<std::array<uint32_t, 256>, 4> tables{};
+            uint32_t directions[32];
+            directions[0] = 1u << 31;
+            for(int bit = 1; bit < 32; ++bit)
+                directions[bit] = directions[bit - 1] ^ (directions[bit - 1] >> 1);
+            for(int byte = 0; byte < 4; ++byte)
+                for(uint32_t value = 0; value < 256; ++value)
+                    for(int bit = 0; bit < 8; ++bit)
+                        if(value & (1u << bit))
+                            tables[byte][value] ^= directions[8 * byte + bit];
+            return tables;
+        }();
+
+        return TABLES[0][index & 0xff] ^ TABLES[1][(index >> 8) & 0xff] ^ TABLES[2][(index >> 16) & 0xff] ^ TABLES[3][index >> 24];
+    }
+
+    /**
+     * @brief Independent uniform values, the same ones AiCo::rand() draws without a sampler.
+     */
+    class independent_sampler : public sampler
+    {
+    public:
+        uint32_t seed;
+        explicit independent_sampler(uint32_t seed = 0) : seed(seed) {}
+
+        [[nodiscard]] float operator()(uint32_t pixel, uint32_t sample, uint32_t dim)const override
+        {
+            return counter_rand(pixel, sample, dim / BOUNCE_DIMENSIONS, dim % BOUNCE_DIMENSIONS, seed);
+        }
+    };
+
+    /**
+     * @brief Jittered strata over each pair of dimensions. Every pair is cut into a k by k grid, k the ceiling of the
+     * square root of %samplesPerPixel, and each pixel visits the cells in its own random order, once each.
+     * Samples past the k * k cells are independent.
+     */
+    class stratified_sampler : public sampler
+    {
+        uint32_t k;
+    public:
+        uint32_t seed;
+        explicit stratified_sampler(uint32_t samplesPerPixel, uint32_t seed = 0) :
+        k(uint32_t(std::ceil(std::sqrt(float(samplesPerPixel))))), seed(seed) {}
+
+        [[nodiscard]] float operator()(uint32_t pixel, uint32_t sample, uint32_t dim)const override
+        {
+            uint32_t cells = k * k;
+            if(sample >= cells)
+                return counter_rand(pixel, sample, dim / BOUNCE_DIMENSIONS, dim % BOUNCE_DIMENSIONS, seed);
+
+            uint32_t pair = dim / 2, a = pixel, b = pair, c = seed, d = 0x5bd1e995u;
+            pcg4d(a, b, c, d);
+            uint32_t cell = permute(sample, cells, a);
+            uint32_t stratum = dim % 2 == 0 ? cell % k : cell / k;
+            float jitter = counter_rand(pixel, sample, dim / BOUNCE_DIMENSIONS, dim % BOUNCE_DIMENSIONS, seed);
+            // the division can round up to 1 in the last stratum
+            return std::min((float(stratum) + jitter) / float(k), 0x1.fffffep-1f);
+        }
+
+        /// @return Image of %i by a random permutation of [0, %n) keyed by %key. Kensler, "Correlated Multi-Jittered Sampling".
+        [[nodiscard]] static uint32_t permute(uint32_t i, uint32_t n, uint32_t key)
+        {
+            uint32_t w = n - 1;
+            w |= w >> 1; w |= w >> 2; w |= w >> 4; w |= w >> 8; w |= w >> 16;
+            // cycle walking: permute within the next power of two until landing in [0, n)
+            do
+            {
+                i ^= key; i *= 0xe170893du; i ^= key >> 16; i ^= (i & w) >> 4;
+                i ^= key >> 8; i *= 0x0929eb3fu; i ^= key >> 23; i ^= (i & w) >> 1;
+                i *= 1u | key >> 27; i *= 0x6935fa69u; i ^= (i & w) >> 11; i *= 0x74dcb303u;
+                i ^= (i & w) >> 2; i *= 0x9e501cc3u; i ^= (i & w) >> 2; i *= 0xc860a3dfu;
+                i &= w; i ^= i >> 5;
+            } while(i >= n);
+            return (i + key) % n;
+        }
+    };
+
+    /**
+     * @brief Owen-scrambled Sobol points, padded in pairs of dimensions (Burley 2020). Each pair takes the first two Sobol
+     * dimensions, scrambled and reordered with seeds hashed from the pixel and the pair, so pairs are independent of each
+     * other and pixels of each other. Every power of two prefix of a pixel's samples is stratified over each pair.
+     */
+    class sobol_sampler : public sampler
+    {
+    public:
+        uint32_t seed;
+        explicit sobol_sampler(uint32_t seed = 0) : seed(seed) {}
+
+        [[nodiscard]] float operator()(uint32_t pixel, uint32_t sample, uint32_t dim)const override
+        {
+            return owen_sobol(pixel, sample, dim, seed);
+        }
+
+        /// @brief Dimension %dim of sample %sample of the sequence keyed by %key.
+        [[nodiscard]] static float owen_sobol(uint32_t key, uint32_t sample, uint32_t dim, uint32_t seed)
+        {
+            uint32_t shuffle = key, seed0 = dim / 2, seed1 = seed, unused = 0x68bc21ebu;
+            pcg4d(shuffle, seed0, seed1, unused);
+
+            uint32_t index = nested_uniform_scramble(sample, shuffle);
+            if(dim % 2 == 0)
+                // the van der Corput point reverses the index, which cancels the first reversal of its scrambling
+                return to_unit_float(reverse_bits(laine_karras_permutation(index, seed0)));
+            return to_unit_float(nested_uniform_scramble(sobol_pascal(index), seed1));
+        }
+    };
+
+    /**
+     * @brief 64 by 64 blue noise mask: values in [0, 1) whose neighbours in any direction differ as much as possible.
+     * Built once by Ulichney's void-and-cluster method, with toroidal distances so that it tiles.
+     */
+    inline const std::array<float, 64 * 64>& blue_noise_mask()
+    {
+        static const std::array<float, 64 * 64> MASK = []
+        {
+            constexpr int SIZE = 64, N = SIZE * SIZE;
+            constexpr float SIGMA = 1.5f;
+
+            // gaussian of the toroidal offset between two cells, the energy one point adds to the cells around it
+            std::vector<float> kernel(N);
+            for(int y = 0; y < SIZE; ++y)
+                for(int x = 0; x < SIZE; ++x)
+                {
+                    float dx = float(std::min(x, SIZE - x)), dy = float(std::min(y, SIZE - y));
+                    kernel[y * SIZE + x] = std::exp(-(dx * dx + dy * dy) / (2.f * SIGMA * SIGMA));
+                }
+
+            std::vector<bool> points(N, false);
+            std::vector<float> energy(N, 0.f);
+            auto toggle = [&](int p, bool on)
+            {
+                points[p] = on;
+                float sign = on ? 1.f : -1.f;
+                int px = p % SIZE, py = p / SIZE;
+                for(int y = 0; y < SIZE; ++y)
+                    for(int x = 0; x < SIZE; ++x)
+                        energy[y * SIZE + x] += sign * kernel[((y - py) & (SIZE - 1)) * SIZE + ((x - px) & (SIZE - 1))];
+            };
+            // tightest cluster: the point with the most energy. Largest void: the empty cell with the least
+            auto tightest = [&]
+            {
+                int best = -1;
+                for(int p = 0; p < N; ++p)
+                    if(points[p] && (best < 0 || energy[p] > energy[best]))
+                        best = p;
+                return best;
+            };
+            auto largest_void = [&]
+            {
+                int best = -1;
+                for(int p = 0; p < N; ++p)
+                    if(!points[p] && (best < 0 || energy[p] < energy[best]))
+                        best = p;
+                return best;
+            };
+
+            // initial pattern: a tenth of the cells at random, relaxed by moving the tightest cluster to the largest void
+            constexpr int INITIAL = N / 10;
+            for(int placed = 0, i = 0; placed < INITIAL; ++i)
+                if(int p = int(counter_rand(uint32_t(i), 0, 0, 0, 0xb1e) * N); !points[p])
+                    toggle(p, true), ++placed;
+            while(true)
+            {
+                int cluster = tightest();
+                toggle(cluster, false);
+                int hole = largest_void();
+                toggle(hole, true);
+                if(hole == cluster)
+                    break;
+            }
+
+            // rank the initial points by removing clusters, then fill voids for the remaining ranks
+            std::array<float, N> mask{};
+            std::vector<bool> initial = points;
+            std::vector<float> initialEnergy = energy;
+            for(int rank = INITIAL - 1; rank >= 0; --rank)
+            {
+                int p = tightest();
+                toggle(p, false);
+                mask[p] = float(rank);
+            }
+            points = initial;
+            energy = initialEnergy;
+            for(int rank = INITIAL; rank < N; ++rank)
+            {
+                int p = largest_void();
+                toggle(p, true);
+                mask[p] = float(rank);
+            }
+
+            for(float& value : mask)
+                value = (value + 0.5f) / float(N);
+            return mask;
+        }();
+        return MASK;
+    }
+
+    /**
+     * @brief Blue noise dithered sampling (Georgiev and Fajardo 2016). Every pixel shares one Owen-scrambled Sobol
+     * sequence, shifted modulo one by the pixel's value in blue_noise_mask(). Neighbouring pixels then get very different
+     * shifts, so the error that remains is spread as high frequency noise across the image instead of in clumps.
+     * Each dimension reads the mask at its own offset.
+     */
+    class blue_noise_sampler : public sampler
+    {
+    public:
+        uint32_t seed;
+        explicit blue_noise_sampler(uint32_t seed = 0) : seed(seed) {}
+
+        [[nodiscard]] float operator()(uint32_t pixel, uint32_t sample, uint32_t dim)const override
+        {
+            uint32_t ox = dim, oy = seed, a = 0x2545f491u, b = 0x9e3779b9u;
+            pcg4d(ox, oy, a, b);
+            uint32_t x = ((pixel & 0xffffu) + ox) & 63u, y = ((pixel >> 16) + oy) & 63u;
+
+            float value = sobol_sampler::owen_sobol(0, sample, dim, seed) + blue_noise_mask()[y * 64 + x];
+            return value >= 1.f ? value - 1.f : value;
+        }
+    };
+}
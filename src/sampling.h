@@ -0,0 +1,211 @@
+#pragma once
+
+#include "glm/geometric.hpp"
+#include "glm/glm.hpp"
+#include "simd.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+/**
+ * Direct mappings from uniform samples in [0, 1)^2 to the unit disk, the unit sphere and the cosine weighted hemisphere.
+ * Unlike rejection sampling they take a fixed amount of work and no branches, and preserve the stratification of their
+ * input.
+ *
+ * Every mapping comes in a scalar form, and in a batch form that fills caller buffers with %n samples at a time using
+ * simd kernels.
+ */
+namespace AiCo::sampling
+{
+    /// @return Uniform sample in [0, 1)^2 from AiCo::rand().
+    [[nodiscard]] inline glm::vec2 rand2(){return {AiCo::rand(), AiCo::rand()};}
+
+    /// @brief sin and cos of %x in [-PI/4, PI/4], from the cephes minimax polynomials. Within about 1 ulp.
+    inline void sincos_octant(float x, float& s, float& c)
+    {
+        float z = x * x;
+        s = ((-1.9515295891e-4f * z + 8.3321608736e-3f) * z - 1.6666654611e-1f) * z * x + x;
+        c = ((2.443315711809948e-5f * z - 1.388731625493765e-3f) * z + 4.166664568298827e-2f) * z * z - 0.5f * z + 1.f;
+    }
+    inline void sincos_octant(simd::vfloat x, simd::vfloat& s, simd::vfloat& c)
+    {
+        using namespace simd;
+        vfloat z = x * x;
+        s = fmadd(fmadd(fmadd(set1(-1.9515295891e-4f), z, set1(8.3321608736e-3f)), z, set1(-1.6666654611e-1f)), z * x, x);
+        c = fmadd(fmadd(fmadd(set1(2.443315711809948e-5f), z, set1(-1.388731625493765e-3f)), z, set1(4.166664568298827e-2f)),
+        z * z, fmadd(set1(-0.5f), z, set1(1.f)));
+    }
+
+    /**
+     * @brief sin and cos of 2*PI*%u for %u in [0, 1). The angle is split into the nearest quarter turn and a remainder
+     * in [-PI/4, PI/4], and the quarter turn swaps and negates the remainder's sin and cos.
+     */
+    inline void sincos_2pi(float u, float& s, float& c)
+    {
+        // rows are quarter turns 0 to 3: (cos, sin) = (so * SIN[q] + co * COS[q], so * COS[q] - co * SIN[q])
+        static constexpr float SIN[4] = {0.f, -1.f, 0.f, 1.f};
+        static constexpr float COS[4] = {1.f, 0.f, -1.f, 0.f};
+
+        float t = 4.f * u;
+        int q = int(t + 0.5f);
+        float so, co;
+        sincos_octant((t - float(q)) * (PI/2.f), so, co);
+        q &= 3;
+        c = so * SIN[q] + co * COS[q];
+        s = so * COS[q] - co * SIN[q];
+    }
+    inline void sincos_2pi(simd::vfloat u, simd::vfloat& s, simd::vfloat& c)
+    {
+        using namespace simd;
+        vfloat t = set1(4.f) * u;
+        vfloat q = trunc(t + set1(0.5f));
+        vfloat so, co;
+        sincos_octant((t - q) * set1(PI/2.f), so, co);
+        c = select(q < set1(0.5f), co, select(q < set1(1.5f), -so, select(q < set1(2.5f), -co, select(q < set1(3.5f), so, co))));
+        s = select(q < set1(0.5f), so, select(q < set1(1.5f), co, select(q < set1(2.5f), -so, select(q < set1(3.5f), -co, so))));
+    }
+
+    /**
+     * @brief Shirley and Chiu's concentric mapping from the square to the unit disk.
+     * Maps concentric squares to concentric circles, so strata stay compact and neighbouring samples stay close.
+     */
+    [[nodiscard]] inline glm::vec2 concentric_disk(glm::vec2 u)
+    {
+        float a = 2.f * u.x - 1.f, b = 2.f * u.y - 1.f;
+        bool xMajor = std::abs(a) > std::abs(b);
+        float r = xMajor ? a : b, other = xMajor ? b : a;
+        float ratio = r != 0.f ? other/r : 0.f;
+
+        float s, c;
+        sincos_octant(PI/4.f * ratio, s, c);
+        // wedges around the y axis are at PI/2 minus the angle, which swaps sin and cos
+        return r * (xMajor ? glm::vec2(c, s) : glm::vec2(s, c));
+    }
+    inline void concentric_disk(simd::vfloat u0, simd::vfloat u1, simd::vfloat& x, simd::vfloat& y)
+    {
+        using namespace simd;
+        vfloat a = fmadd(set1(2.f), u0, set1(-1.f)), b = fmadd(set1(2.f), u1, set1(-1.f));
+        vmask xMajor = abs(a) > abs(b);
+        vfloat r = select(xMajor, a, b), other = select(xMajor, b, a);
+        vfloat ratio = select(abs(r) > set1(0.f), other/r, set1(0.f));
+
+        vfloat s, c;
+        sincos_octant(set1(PI/4.f) * ratio, s, c);
+        x = r * select(xMajor, c, s);
+        y = r * select(xMajor, s, c);
+    }
+
+    [[nodiscard]] inline glm::vec3 uniform_sphere(glm::vec2 u)
+    {
+        float z = 1.f - 2.f * u.x;
+        float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        float s, c;
+        sincos_2pi(u.y, s, c);
+        return {r * c, r * s, z};
+    }
+    inline void uniform_sphere(simd::vfloat u0, simd::vfloat u1, simd::vfloat& x, simd::vfloat& y, simd::vfloat& z)
+    {
+        using namespace simd;
+        z = fmadd(set1(-2.f), u0, set1(1.f));
+        vfloat r = sqrt(max(set1(0.f), set1(1.f) - z * z));
+        vfloat s, c;
+        sincos_2pi(u1, s, c);
+        x = r * c;
+        y = r * s;
+    }
+    [[nodiscard]] constexpr float uniform_sphere_pdf(){return 1.f/(4.f * PI);}
+
+    /// @brief Cosine weighted direction on the hemisphere around +z, by lifting a concentric_disk() sample (Malley's method).
+    [[nodiscard]] inline glm::vec3 cosine_hemisphere(glm::vec2 u)
+    {
+        glm::vec2 d = concentric_disk(u);
+        return {d.x, d.y, std::sqrt(std::max(0.f, 1.f - d.x * d.x - d.y * d.y))};
+    }
+    inline void cosine_hemisphere(simd::vfloat u0, simd::vfloat u1, simd::vfloat& x, simd::vfloat& y, simd::vfloat& z)
+    {
+        using namespace simd;
+        concentric_disk(u0, u1, x, y);
+        z = sqrt(max(set1(0.f), set1(1.f) - x * x - y * y));
+    }
+    [[nodiscard]] inline float cosine_hemisphere_pdf(float cosTheta){return cosTheta/PI;}
+
+    /**
+     * @brief Completes unit vector %N to an orthonormal basis (%t, %b, %N) without branches.
+     * Duff et al., "Building an Orthonormal Basis, Revisited" (JCGT 2017).
+     */
+    inline void orthonormal_basis(const glm::vec3& N, glm::vec3& t, glm::vec3& b)
+    {
+        float sign = std::copysign(1.f, N.z);
+        float a = -1.f/(sign + N.z);
+        float c = N.x * N.y * a;
+        t = {1.f + sign * N.x * N.x * a, sign * c, -sign * N.x};
+        b = {c, sign + N.y * N.y * a, -N.y};
+    }
+    /// @brief Cosine weighted direction on the hemisphere around unit vector %N.
+    [[nodiscard]] inline glm::vec3 cosine_hemisphere(const glm::vec3& N, glm::vec2 u)
+    {
+        glm::vec3 t, b;
+        orthonormal_basis(N, t, b);
+        glm::vec3 local = cosine_hemisphere(u);
+        return local.x * t + local.y * b + local.z * N;
+    }
+
+    /// @brief Batch concentric_disk(). Maps (%u0[i], %u1[i]) to (%x[i], %y[i]) for every i in [0, %n).
+    inline void concentric_disk(size_t n, const float* u0, const float* u1, float* x, float* y)
+    {
+        using namespace simd;
+        size_t i = 0;
+        for(; i + WIDTH <= n; i += WIDTH)
+        {
+            vfloat dx, dy;
+            concentric_disk(loadu(u0 + i), loadu(u1 + i), dx, dy);
+            storeu(x + i, dx);
+            storeu(y + i, dy);
+        }
+        for(; i < n; ++i)
+        {
+            glm::vec2 d = concentric_disk({u0[i], u1[i]});
+            x[i] = d.x; y[i] = d.y;
+        }
+    }
+    /// @brief Batch uniform_sphere(). Maps (%u0[i], %u1[i]) to (%x[i], %y[i], %z[i]) for every i in [0, %n).
+    inline void uniform_sphere(size_t n, const float* u0, const float* u1, float* x, float* y, float* z)
+    {
+        using namespace simd;
+        size_t i = 0;
+        for(; i + WIDTH <= n; i += WIDTH)
+        {
+            vfloat dx, dy, dz;
+            uniform_sphere(loadu(u0 + i), loadu(u1 + i), dx, dy, dz);
+            storeu(x + i, dx);
+            storeu(y + i, dy);
+            storeu(z + i, dz);
+        }
+        for(; i < n; ++i)
+        {
+            glm::vec3 d = uniform_sphere({u0[i], u1[i]});
+            x[i] = d.x; y[i] = d.y; z[i] = d.z;
+        }
+    }
+    /// @brief Batch cosine_hemisphere() around +z. Maps (%u0[i], %u1[i]) to (%x[i], %y[i], %z[i]) for every i in [0, %n).
+    inline void cosine_hemisphere(size_t n, const float* u0, const float* u1, float* x, float* y, float* z)
+    {
+        using namespace simd;
+        size_t i = 0;
+        for(; i + WIDTH <= n; i += WIDTH)
+        {
+            vfloat dx, dy, dz;
+            cosine_hemisphere(loadu(u0 + i), loadu(u1 + i), dx, dy, dz);
+            storeu(x + i, dx);
+            storeu(y + i, dy);
+            storeu(z + i, dz);
+        }
+        for(; i < n; ++i)
+        {
+            glm::vec3 d = cosine_hemisphere(glm::vec2{u0[i], u1[i]});
+            x[i] = d.x; y[i] = d.y; z[i] = d.z;
+        }
+    }
+}
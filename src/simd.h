@@ -0,0 +1,323 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__AVX512F__) || defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+/**
+ * Thin wrappers over the widest float vector the target supports: AVX-512 (16 lanes), AVX2 (8 lanes), SSE2 (4 lanes),
+ * or a scalar fallback (1 lane). The instruction set is picked at compile time, so build with -march=native
+ * (the NATIVE_ARCH cmake option) to get the wide paths.
+ *
+ * Kernels are written once against vfloat, vint and vmask and loop in steps of WIDTH.
+ */
+namespace AiCo::simd
+{
+#if defined(__AVX512F__)
+    constexpr size_t WIDTH = 16;
+
+    struct vfloat{__m512 v;};
+    struct vint{__m512i v;};
+    struct vmask{__mmask16 m;};
+
+    inline vfloat set1(float x){return {_mm512_set1_ps(x)};}
+    inline vint set1(int32_t x){return {_mm512_set1_epi32(x)};}
+    inline vfloat load(const float* ptr){return {_mm512_load_ps(ptr)};}
+    inline vfloat loadu(const float* ptr){return {_mm512_loadu_ps(ptr)};}
+    inline void store(float* ptr, vfloat a){_mm512_store_ps(ptr, a.v);}
+    inline void storeu(float* ptr, vfloat a){_mm512_storeu_ps(ptr, a.v);}
+    inline void storeu(int32_t* ptr, vint a){_mm512_storeu_si512(ptr, a.v);}
+    inline vint loadu(const int32_t* ptr){return {_mm512_loadu_si512(ptr)};}
+
+    inline vfloat operator+(vfloat a, vfloat b){return {_mm512_add_ps(a.v, b.v)};}
+    inline vfloat operator-(vfloat a, vfloat b){return {_mm512_sub_ps(a.v, b.v)};}
+    inline vfloat operator*(vfloat a, vfloat b){return {_mm512_mul_ps(a.v, b.v)};}
+    inline vfloat operator/(vfloat a, vfloat b){return {_mm512_div_ps(a.v, b.v)};}
+    /// @return a * b + c
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c){return {_mm512_fmadd_ps(a.v, b.v, c.v)};}
+    inline vfloat sqrt(vfloat a){return {_mm512_sqrt_ps(a.v)};}
+    inline vfloat min(vfloat a, vfloat b){return {_mm512_min_ps(a.v, b.v)};}
+    inline vfloat max(vfloat a, vfloat b){return {_mm512_max_ps(a.v, b.v)};}
+    inline vfloat abs(vfloat a){return {_mm512_abs_ps(a.v)};}
+    /// @return %a rounded towards zero.
+    inline vfloat trunc(vfloat a){return {_mm512_roundscale_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)};}
+
+    inline vmask operator<(vfloat a, vfloat b){return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ)};}
+    inline vmask operator<=(vfloat a, vfloat b){return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_LE_OQ)};}
+    inline vmask operator>(vfloat a, vfloat b){return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ)};}
+    inline vmask operator>=(vfloat a, vfloat b){return {_mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ)};}
+    inline vmask operator&(vmask a, vmask b){return {__mmask16(a.m & b.m)};}
+    inline vmask operator|(vmask a, vmask b){return {__mmask16(a.m | b.m)};}
+
+    /// @return Lane-wise %a where %m is set, %b elsewhere.
+    inline vfloat select(vmask m, vfloat a, vfloat b){return {_mm512_mask_blend_ps(m.m, b.v, a.v)};}
+    inline vint select(vmask m, vint a, vint b){return {_mm512_mask_blend_epi32(m.m, b.v, a.v)};}
+    inline unsigned bitmask(vmask m){return m.m;}
+
+    inline vint operator+(vint a, vint b){return {_mm512_add_epi32(a.v, b.v)};}
+    /// @return Low 32 bits of the lane-wise product, the same for signed and unsigned lanes.
+    inline vint operator*(vint a, vint b){return {_mm512_mullo_epi32(a.v, b.v)};}
+    inline vint operator^(vint a, vint b){return {_mm512_xor_si512(a.v, b.v)};}
+    /// @return Lanes shifted right by %n bits, filling with zeroes.
+    inline vint operator>>(vint a, int n){return {_mm512_srli_epi32(a.v, unsigned(n))};}
+    inline vfloat to_float(vint a){return {_mm512_cvtepi32_ps(a.v)};}
+    /// @return %a rounded towards zero.
+    inline vint to_int(vfloat a){return {_mm512_cvttps_epi32(a.v)};}
+    /// @return Lanes where %a > %b as signed integers.
+    inline vmask operator>(vint a, vint b){return {_mm512_cmpgt_epi32_mask(a.v, b.v)};}
+    /// @return {0, 1, ..., WIDTH - 1}
+    inline vint iota(){return {_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15)};}
+    inline vint operator-(vint a, vint b){return {_mm512_sub_epi32(a.v, b.v)};}
+    inline vint operator&(vint a, vint b){return {_mm512_and_si512(a.v, b.v)};}
+    inline vint operator|(vint a, vint b){return {_mm512_or_si512(a.v, b.v)};}
+    inline vint operator<<(vint a, int n){return {_mm512_slli_epi32(a.v, unsigned(n))};}
+    /// @return The bits of %a, unconverted.
+    inline vint as_int(vfloat a){return {_mm512_castps_si512(a.v)};}
+    /// @return table[idx] per lane. Reads 4 bytes from each entry, so %table must be readable 3 bytes past the last index.
+    inline vint gather_u8(const uint8_t* table, vint idx){return {_mm512_and_si512(_mm512_i32gather_epi32(idx.v, table, 1), _mm512_set1_epi32(0xff))};}
+    /// @return Mask of the lanes whose index is below %n.
+    inline vmask lanes_below(size_t n){return {n >= WIDTH ? __mmask16(0xFFFF) : __mmask16((1u << n) - 1)};}
+
+#elif defined(__AVX2__)
+    constexpr size_t WIDTH = 8;
+
+    struct vfloat{__m256 v;};
+    struct vint{__m256i v;};
+    struct vmask{__m256 m;};
+
+    inline vfloat set1(float x){return {_mm256_set1_ps(x)};}
+    inline vint set1(int32_t x){return {_mm256_set1_epi32(x)};}
+    inline vfloat load(const float* ptr){return {_mm256_load_ps(ptr)};}
+    inline vfloat loadu(const float* ptr){return {_mm256_loadu_ps(ptr)};}
+    inline void store(float* ptr, vfloat a){_mm256_store_ps(ptr, a.v);}
+    inline void storeu(float* ptr, vfloat a){_mm256_storeu_ps(ptr, a.v);}
+    inline void storeu(int32_t* ptr, vint a){_mm256_storeu_si256(reinterpret_cast<__m256i*>(ptr), a.v);}
+    inline vint loadu(const int32_t* ptr){return {_mm256_loadu_si256(reinterpret_cast<const __m256i*>(ptr))};}
+
+    inline vfloat operator+(vfloat a, vfloat b){return {_mm256_add_ps(a.v, b.v)};}
+    inline vfloat operator-(vfloat a, vfloat b){return {_mm256_sub_ps(a.v, b.v)};}
+    inline vfloat operator*(vfloat a, vfloat b){return {_mm256_mul_ps(a.v, b.v)};}
+    inline vfloat operator/(vfloat a, vfloat b){return {_mm256_div_ps(a.v, b.v)};}
+#if defined(__FMA__)
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c){return {_mm256_fmadd_ps(a.v, b.v, c.v)};}
+#else
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c){return a * b + c;}
+#endif
+    inline vfloat sqrt(vfloat a){return {_mm256_sqrt_ps(a.v)};}
+    inline vfloat min(vfloat a, vfloat b){return {_mm256_min_ps(a.v, b.v)};}
+    inline vfloat max(vfloat a, vfloat b){return {_mm256_max_ps(a.v, b.v)};}
+    inline vfloat abs(vfloat a){return {_mm256_andnot_ps(_mm256_set1_ps(-0.f), a.v)};}
+    inline vfloat trunc(vfloat a){return {_mm256_round_ps(a.v, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)};}
+
+    inline vmask operator<(vfloat a, vfloat b){return {_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)};}
+    inline vmask operator<=(vfloat a, vfloat b){return {_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)};}
+    inline vmask operator>(vfloat a, vfloat b){return {_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)};}
+    inline vmask operator>=(vfloat a, vfloat b){return {_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)};}
+    inline vmask operator&(vmask a, vmask b){return {_mm256_and_ps(a.m, b.m)};}
+    inline vmask operator|(vmask a, vmask b){return {_mm256_or_ps(a.m, b.m)};}
+
+    inline vfloat select(vmask m, vfloat a, vfloat b){return {_mm256_blendv_ps(b.v, a.v, m.m)};}
+    inline vint select(vmask m, vint a, vint b){return {_mm256_blendv_epi8(b.v, a.v, _mm256_castps_si256(m.m))};}
+    inline unsigned bitmask(vmask m){return unsigned(_mm256_movemask_ps(m.m));}
+
+    inline vint operator+(vint a, vint b){return {_mm256_add_epi32(a.v, b.v)};}
+    inline vint operator*(vint a, vint b){return {_mm256_mullo_epi32(a.v, b.v)};}
+    inline vint operator^(vint a, vint b){return {_mm256_xor_si256(a.v, b.v)};}
+    inline vint operator>>(vint a, int n){return {_mm256_srli_epi32(a.v, n)};}
+    inline vfloat to_float(vint a){return {_mm256_cvtepi32_ps(a.v)};}
+    inline vint to_int(vfloat a){return {_mm256_cvttps_epi32(a.v)};}
+    inline vmask operator>(vint a, vint b){return {_mm256_castsi256_ps(_mm256_cmpgt_epi32(a.v, b.v))};}
+    inline vint iota(){return {_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)};}
+    inline vint operator-(vint a, vint b){return {_mm256_sub_epi32(a.v, b.v)};}
+    inline vint operator&(vint a, vint b){return {_mm256_and_si256(a.v, b.v)};}
+    inline vint operator|(vint a, vint b){return {_mm256_or_si256(a.v, b.v)};}
+    inline vint operator<<(vint a, int n){return {_mm256_slli_epi32(a.v, n)};}
+    inline vint as_int(vfloat a){return {_mm256_castps_si256(a.v)};}
+    inline vint gather_u8(const uint8_t* table, vint idx)
+    {
+        return {_mm256_and_si256(_mm256_i32gather_epi32(reinterpret_cast<const int*>(table), idx.v, 1), _mm256_set1_epi32(0xff))};
+    }
+    inline vmask lanes_below(size_t n)
+    {
+        __m256i below = _mm256_cmpgt_epi32(_mm256_set1_epi32(int32_t(std::min(n, WIDTH))), iota().v);
+        return {_mm256_castsi256_ps(below)};
+    }
+
+#elif defined(__SSE2__)
+    constexpr size_t WIDTH = 4;
+
+    struct vfloat{__m128 v;};
+    struct vint{__m128i v;};
+    struct vmask{__m128 m;};
+
+    inline vfloat set1(float x){return {_mm_set1_ps(x)};}
+    inline vint set1(int32_t x){return {_mm_set1_epi32(x)};}
+    inline vfloat load(const float* ptr){return {_mm_load_ps(ptr)};}
+    inline vfloat loadu(const float* ptr){return {_mm_loadu_ps(ptr)};}
+    inline void store(float* ptr, vfloat a){_mm_store_ps(ptr, a.v);}
+    inline void storeu(float* ptr, vfloat a){_mm_storeu_ps(ptr, a.v);}
+    inline void storeu(int32_t* ptr, vint a){_mm_storeu_si128(reinterpret_cast<__m128i*>(ptr), a.v);}
+    inline vint loadu(const int32_t* ptr){return {_mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr))};}
+
+    inline vfloat operator+(vfloat a, vfloat b){return {_mm_add_ps(a.v, b.v)};}
+    inline vfloat operator-(vfloat a, vfloat b){return {_mm_sub_ps(a.v, b.v)};}
+    inline vfloat operator*(vfloat a, vfloat b){return {_mm_mul_ps(a.v, b.v)};}
+    inline vfloat operator/(vfloat a, vfloat b){return {_mm_div_ps(a.v, b.v)};}
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c){return a * b + c;}
+    inline vfloat sqrt(vfloat a){return {_mm_sqrt_ps(a.v)};}
+    inline vfloat min(vfloat a, vfloat b){return {_mm_min_ps(a.v, b.v)};}
+    inline vfloat max(vfloat a, vfloat b){return {_mm_max_ps(a.v, b.v)};}
+    inline vfloat abs(vfloat a){return {_mm_andnot_ps(_mm_set1_ps(-0.f), a.v)};}
+    // SSE2 has no round instruction. Exact for |a| < 2^31
+    inline vfloat trunc(vfloat a){return {_mm_cvtepi32_ps(_mm_cvttps_epi32(a.v))};}
+
+    inline vmask operator<(vfloat a, vfloat b){return {_mm_cmplt_ps(a.v, b.v)};}
+    inline vmask operator<=(vfloat a, vfloat b){return {_mm_cmple_ps(a.v, b.v)};}
+    inline vmask operator>(vfloat a, vfloat b){return {_mm_cmpgt_ps(a.v, b.v)};}
+    inline vmask operator>=(vfloat a, vfloat b){return {_mm_cmpge_ps(a.v, b.v)};}
+    inline vmask operator&(vmask a, vmask b){return {_mm_and_ps(a.m, b.m)};}
+    inline vmask operator|(vmask a, vmask b){return {_mm_or_ps(a.m, b.m)};}
+
+    // SSE2 has no blend instruction
+    inline vfloat select(vmask m, vfloat a, vfloat b){return {_mm_or_ps(_mm_and_ps(m.m, a.v), _mm_andnot_ps(m.m, b.v))};}
+    inline vint select(vmask m, vint a, vint b)
+    {
+        __m128i mi = _mm_castps_si128(m.m);
+        return {_mm_or_si128(_mm_and_si128(mi, a.v), _mm_andnot_si128(mi, b.v))};
+    }
+    inline unsigned bitmask(vmask m){return unsigned(_mm_movemask_ps(m.m));}
+
+    inline vint operator+(vint a, vint b){return {_mm_add_epi32(a.v, b.v)};}
+    // SSE2 only multiplies even lanes into 64 bits, multiply even and odd lanes separately and interleave the low halves
+    inline vint operator*(vint a, vint b)
+    {
+        __m128i even = _mm_mul_epu32(a.v, b.v);
+        __m128i odd = _mm_mul_epu32(_mm_srli_si128(a.v, 4), _mm_srli_si128(b.v, 4));
+        return {_mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)))};
+    }
+    inline vint operator^(vint a, vint b){return {_mm_xor_si128(a.v, b.v)};}
+    inline vint operator>>(vint a, int n){return {_mm_srli_epi32(a.v, n)};}
+    inline vfloat to_float(vint a){return {_mm_cvtepi32_ps(a.v)};}
+    inline vint to_int(vfloat a){return {_mm_cvttps_epi32(a.v)};}
+    inline vmask operator>(vint a, vint b){return {_mm_castsi128_ps(_mm_cmpgt_epi32(a.v, b.v))};}
+    inline vint iota(){return {_mm_setr_epi32(0, 1, 2, 3)};}
+    inline vint operator-(vint a, vint b){return {_mm_sub_epi32(a.v, b.v)};}
+    inline vint operator&(vint a, vint b){return {_mm_and_si128(a.v, b.v)};}
+    inline vint operator|(vint a, vint b){return {_mm_or_si128(a.v, b.v)};}
+    inline vint operator<<(vint a, int n){return {_mm_slli_epi32(a.v, n)};}
+    inline vint as_int(vfloat a){return {_mm_castps_si128(a.v)};}
+    // no gather before AVX2
+    inline vint gather_u8(const uint8_t* table, vint idx)
+    {
+        alignas(16) int32_t lanes[4];
+        _mm_store_si128(reinterpret_cast<__m128i*>(lanes), idx.v);
+        return {_mm_setr_epi32(table[lanes[0]], table[lanes[1]], table[lanes[2]], table[lanes[3]])};
+    }
+    inline vmask lanes_below(size_t n)
+    {
+        __m128i below = _mm_cmpgt_epi32(_mm_set1_epi32(int32_t(std::min(n, WIDTH))), iota().v);
+        return {_mm_castsi128_ps(below)};
+    }
+
+#else
+    constexpr size_t WIDTH = 1;
+
+    struct vfloat{float v;};
+    struct vint{int32_t v;};
+    struct vmask{bool m;};
+
+    inline vfloat set1(float x){return {x};}
+    inline vint set1(int32_t x){return {x};}
+    inline vfloat load(const float* ptr){return {*ptr};}
+    inline vfloat loadu(const float* ptr){return {*ptr};}
+    inline void store(float* ptr, vfloat a){*ptr = a.v;}
+    inline void storeu(float* ptr, vfloat a){*ptr = a.v;}
+    inline void storeu(int32_t* ptr, vint a){*ptr = a.v;}
+    inline vint loadu(const int32_t* ptr){return {*ptr};}
+
+    inline vfloat operator+(vfloat a, vfloat b){return {a.v + b.v};}
+    inline vfloat operator-(vfloat a, vfloat b){return {a.v - b.v};}
+    inline vfloat operator*(vfloat a, vfloat b){return {a.v * b.v};}
+    inline vfloat operator/(vfloat a, vfloat b){return {a.v / b.v};}
+    inline vfloat fmadd(vfloat a, vfloat b, vfloat c){return {a.v * b.v + c.v};}
+    inline vfloat sqrt(vfloat a){return {std::sqrt(a.v)};}
+    // like minps and maxps, b when either is NaN
+    inline vfloat min(vfloat a, vfloat b){return {a.v < b.v ? a.v : b.v};}
+    inline vfloat max(vfloat a, vfloat b){return {a.v > b.v ? a.v : b.v};}
+    inline vfloat abs(vfloat a){return {std::abs(a.v)};}
+    inline vfloat trunc(vfloat a){return {std::trunc(a.v)};}
+
+    inline vmask operator<(vfloat a, vfloat b){return {a.v < b.v};}
+    inline vmask operator<=(vfloat a, vfloat b){return {a.v <= b.v};}
+    inline vmask operator>(vfloat a, vfloat b){return {a.v > b.v};}
+    inline vmask operator>=(vfloat a, vfloat b){return {a.v >= b.v};}
+    inline vmask operator&(vmask a, vmask b){return {a.m && b.m};}
+    inline vmask operator|(vmask a, vmask b){return {a.m || b.m};}
+
+    inline vfloat select(vmask m, vfloat a, vfloat b){return m.m ? a : b;}
+    inline vint select(vmask m, vint a, vint b){return m.m ? a : b;}
+    inline unsigned bitmask(vmask m){return m.m;}
+
+    inline vint operator+(vint a, vint b){return {int32_t(uint32_t(a.v) + uint32_t(b.v))};}
+    inline vint operator*(vint a, vint b){return {int32_t(uint32_t(a.v) * uint32_t(b.v))};}
+    inline vint operator^(vint a, vint b){return {a.v ^ b.v};}
+    inline vint operator>>(vint a, int n){return {int32_t(uint32_t(a.v) >> n)};}
+    inline vfloat to_float(vint a){return {float(a.v)};}
+    inline vint to_int(vfloat a){return {int32_t(a.v)};}
+    inline vmask operator>(vint a, vint b){return {a.v > b.v};}
+    inline vint iota(){return {0};}
+    inline vint operator-(vint a, vint b){return {int32_t(uint32_t(a.v) - uint32_t(b.v))};}
+    inline vint operator&(vint a, vint b){return {a.v & b.v};}
+    inline vint operator|(vint a, vint b){return {a.v | b.v};}
+    inline vint operator<<(vint a, int n){return {int32_t(uint32_t(a.v) << n)};}
+    inline vint as_int(vfloat a){int32_t bits; std::memcpy(&bits, &a.v, sizeof(bits)); return {bits};}
+    inline vint gather_u8(const uint8_t* table, vint idx){return {table[idx.v]};}
+    inline vmask lanes_below(size_t n){return {n > 0};}
+#endif
+
+    inline vfloat operator-(vfloat a){return set1(0.f) - a;}
+    inline vfloat& operator+=(vfloat& a, vfloat b){return a = a + b;}
+    inline vint& operator+=(vint& a, vint b){return a = a + b;}
+    inline vint& operator^=(vint& a, vint b){return a = a ^ b;}
+    inline vfloat& operator-=(vfloat& a, vfloat b){return a = a - b;}
+    inline vfloat& operator*=(vfloat& a, vfloat b){return a = a * b;}
+    inline vmask& operator&=(vmask& a, vmask b){return a = a & b;}
+    inline vmask& operator|=(vmask& a, vmask b){return a = a | b;}
+
+    inline bool any(vmask m){return bitmask(m) != 0;}
+
+    /**
+     * @brief Copies %bytes bytes from %src to %dst with non-temporal stores, which write whole lines to memory without
+     * reading them into cache first. For output that is not read again soon, and whose lines other threads may hold.
+     * The stores are weakly ordered: call stream_fence() before anything else reads %dst.
+     */
+    inline void stream_copy(void* dst, const void* src, size_t bytes)
+    {
+#if defined(__SSE2__)
+        // 16 byte stores are enough, the write combining buffers merge them into full lines either way
+        auto* d = static_cast<char*>(dst);
+        auto* s = static_cast<const char*>(src);
+        size_t head = std::min(bytes, (16 - reinterpret_cast<uintptr_t>(d) % 16) % 16);
+        std::memcpy(d, s, head);
+        size_t i = head;
+        for(; i + 16 <= bytes; i += 16)
+            _mm_stream_si128(reinterpret_cast<__m128i*>(d + i), _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i)));
+        std::memcpy(d + i, s + i, bytes - i);
+#else
+        std::memcpy(dst, src, bytes);
+#endif
+    }
+    /// @brief Orders the stream_copy() stores of this thread before its later stores, e.g. releasing a lock or a task.
+    inline void stream_fence()
+    {
+#if defined(__SSE2__)
+        _mm_sfence();
+#endif
+    }
+}
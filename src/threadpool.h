@@ -1,7 +1,12 @@
 #pragma once
 
-#include <condition_variable>
+#include "aligned.h"
+#include "work_deque.h"
+
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <functional>
 #include <memory>
@@ -12,103 +17,374 @@
 
 namespace AiCo
 {
+    /**
+     * @brief Work-stealing thread pool.
+     *
+     * Every worker owns a work_deque. Jobs enqueued by a worker go to its own deque without locking and run newest first,
+     * while idle workers steal the oldest jobs of the others. Jobs enqueued from any other thread go through one shared
+     * queue. Workers that run out of work park on a futex, and every enqueue wakes at most one of them.
+     *
+     * parallel_for() and parallel_reduce() split their range with fork_join(), whose jobs live on the stack of the forking
+     * thread. The calling thread takes part in the work instead of blocking.
+     */
     class threadpool
     {
+        /// Unit of work, type erased through a plain function pointer so that it needs no particular storage.
+        struct job
+        {
+            void (*execute)(job*);
+        };
+        struct function_job : job
+        {
+            std::function<void()> fn;
+
+            function_job(const std::function<void()>& fn) : job{&run}, fn(fn) {}
+            static void run(job* j)
+            {
+                auto* self = static_cast<function_job*>(j);
+                self->fn();
+                delete self;
+            }
+        };
+        struct worker
+        {
+            work_deque<job> jobs;
+            uint32_t seed;
+
+            explicit worker(uint32_t seed) : seed(seed) {}
+        };
+        /// Job that lives on the stack of the thread that forked it, see fork_join().
+        template<typename F>
+        struct fork_job : job
+        {
+            const F& fn;
+            std::atomic<bool> done{false};
+
+            fork_job(const F& fn) : job{&run}, fn(fn) {}
+            static void run(job* j)
+            {
+                auto* self = static_cast<fork_job*>(j);
+                self->fn();
+                // the forking thread may return and destroy the job as soon as it sees this
+                self->done.store(true, std::memory_order_release);
+            }
+        };
+
+        /// Rounds of looking for work before a worker parks. New work often arrives within microseconds.
+        static constexpr int SPIN_ROUNDS = 32;
+
+        /// One per thread, plus a last guest deque that lets one outside thread at a time fork and join like a worker.
+        std::vector<std::unique_ptr<worker>> workers;
+        std::atomic<bool> guestClaimed{false};
         std::vector<std::thread> threads;
+
         std::mutex poolMutex;
-        std::queue<std::function<void()>> jobQueue;
-        std::condition_variable mutexCond;
-        bool shouldTerminate = false;
+        std::queue<job*> jobQueue;
+        std::atomic<size_t> queuedJobs{0};
 
-        std::condition_variable idleCond;
-        unsigned int activeThreads = 0;
+        /// Jobs enqueued but not finished yet.
+        alignas(CACHE_LINE) std::atomic<size_t> pendingJobs{0};
+        /// Bumped to wake parked workers, which wait for it to change.
+        alignas(CACHE_LINE) std::atomic<uint32_t> wakeEpoch{0};
+        std::atomic<uint32_t> sleepers{0};
+        std::atomic<bool> shouldTerminate{false};
 
-        void loop()
+        inline static thread_local threadpool* currentPool = nullptr;
+        inline static thread_local size_t currentWorker = 0;
+
+        void loop(size_t idx)
         {
+            currentPool = this;
+            currentWorker = idx;
+
             while(true)
             {
-                std::function<void()> job;
+                job* j = nullptr;
+                for(int round = 0; round < SPIN_ROUNDS && !j; ++round)
+                    if(!(j = find_job(idx)))
+                        std::this_thread::yield();
+
+                if(j)
+                    run(j);
+                else if(shouldTerminate.load(std::memory_order_acquire))
+                    return;
+                else
+                    park();
+            }
+        }
+
+        /// @return A job from the own deque, the shared queue or another worker, in that order. nullptr if none was found.
+        job* find_job(size_t idx)
+        {
+            worker& self = *workers[idx];
+            if(job* j = self.jobs.take())
+                return j;
 
-                if(empty())
+            if(queuedJobs.load(std::memory_order_relaxed) != 0)
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                if(!jobQueue.empty())
                 {
-                    std::unique_lock<std::mutex> lock(poolMutex);
-                    mutexCond.wait(lock, [this](){return !jobQueue.empty() || shouldTerminate;});
-                    if (shouldTerminate)
-                        return;
+                    job* j = jobQueue.front();
+                    jobQueue.pop();
+                    queuedJobs.fetch_sub(1, std::memory_order_relaxed);
+                    return j;
                 }
+            }
+
+            // xorshift picks the first victim, so that thieves spread out
+            self.seed ^= self.seed << 13; self.seed ^= self.seed >> 17; self.seed ^= self.seed << 5;
+            for(size_t i = 0, n = workers.size(); i < n; ++i)
+            {
+                size_t victim = (self.seed + i) % n;
+                if(victim == idx)
+                    continue;
+                if(job* j = workers[victim]->jobs.steal())
+                    return j;
+            }
+            return nullptr;
+        }
+
+        bool has_work()const
+        {
+            if(queuedJobs.load(std::memory_order_relaxed) != 0)
+                return true;
+            for(const auto& w : workers)
+                if(!w->jobs.empty())
+                    return true;
+            return false;
+        }
+
+        void run(job* j)
+        {
+            j->execute(j);
+            if(pendingJobs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                pendingJobs.notify_all();
+        }
+
+        void park()
+        {
+            uint32_t epoch = wakeEpoch.load(std::memory_order_acquire);
+            sleepers.fetch_add(1, std::memory_order_relaxed);
+            // pairs with the fence in wake_one(): either the work is seen here, or the sleeper is seen there
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(!has_work() && !shouldTerminate.load(std::memory_order_acquire))
+                wakeEpoch.wait(epoch, std::memory_order_acquire);
+            sleepers.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        void wake_one()
+        {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if(sleepers.load(std::memory_order_relaxed) == 0)
+                return;
+            wakeEpoch.fetch_add(1, std::memory_order_release);
+            wakeEpoch.notify_one();
+        }
+
+        /// Makes the calling outside thread the owner of the guest deque while in scope, if no other thread owns it.
+        struct guest_scope
+        {
+            threadpool& pool;
+            bool entered;
+            // the thread may be a worker of another pool
+            threadpool* outerPool = currentPool;
+            size_t outerWorker = currentWorker;
+
+            guest_scope(threadpool& pool) : pool(pool), entered(!pool.guestClaimed.exchange(true, std::memory_order_acquire))
+            {
+                if(entered)
                 {
-                    std::unique_lock<std::mutex> lock(poolMutex);
-                    if(jobQueue.empty())
-                        continue; // TODO the fact that code is reaching here is dangerous. Examine this!
-                    job = jobQueue.front();
-                    jobQueue.pop();
-                    activeThreads++;
+                    currentPool = &pool;
+                    currentWorker = pool.workers.size() - 1;
                 }
+            }
+            ~guest_scope()
+            {
+                if(!entered)
+                    return;
+                currentPool = outerPool;
+                currentWorker = outerWorker;
+                // every job forked into the guest deque has been joined, so it is empty for the next guest
+                pool.guestClaimed.store(false, std::memory_order_release);
+            }
+        };
 
-                if(job)
-                    job();
-                
+        /**
+         * @brief Runs %fn on the calling thread as a worker of this pool, so that it can fork and join.
+         * Outside threads borrow the guest deque. If another outside thread holds it, %fn is handed to the workers whole
+         * and the calling thread only waits. A pool without workers could never run it, so there the calling thread waits
+         * for the guest deque instead.
+         */
+        template<typename F>
+        void as_worker(const F& fn)
+        {
+            if(currentPool == this)
+            {
+                fn();
+                return;
+            }
+            while(true)
+            {
+                if(guest_scope guest(*this); guest.entered)
                 {
-                    std::unique_lock<std::mutex> lock(poolMutex);
-                    activeThreads--;
+                    fn();
+                    return;
                 }
-                if(all_idle())
-                    idleCond.notify_all();
+                if(!threads.empty())
+                    break;
+                std::this_thread::yield();
+            }
+            fork_job<F> whole(fn);
+            submit(&whole);
+            while(!whole.done.load(std::memory_order_acquire))
+                std::this_thread::yield();
+        }
+
+        /// @brief fork_join() for callers that already run as a worker.
+        template<typename fn_a, typename fn_b>
+        void spawn_join(const fn_a& a, const fn_b& b)
+        {
+            fork_job<fn_b> forked(b);
+            submit(&forked);
+            a();
+            // runs %forked itself unless it was stolen, and other jobs until a thief has finished it
+            while(!forked.done.load(std::memory_order_acquire))
+            {
+                if(job* j = find_job(currentWorker))
+                    run(j);
+                else
+                    std::this_thread::yield();
             }
         }
-        bool all_idle()
+
+        template<typename index_fn>
+        void for_range(size_t begin, size_t end, size_t grain, const index_fn& fn)
         {
-            unsigned int threads, jobs;
-            bool ret = false;
+            if(end - begin <= grain)
             {
-                std::lock_guard<std::mutex> idleLock(poolMutex);
-                threads = activeThreads; jobs = jobQueue.size();
-                ret = threads == 0 && jobs == 0;
+                for(size_t i = begin; i < end; ++i)
+                    fn(i);
+                return;
             }
+            size_t mid = begin + (end - begin)/2;
+            spawn_join([&]{for_range(begin, mid, grain, fn);}, [&]{for_range(mid, end, grain, fn);});
+        }
 
-            return ret;
+        template<typename T, typename map_fn, typename reduce_fn>
+        T reduce_range(size_t begin, size_t end, size_t grain, const T& identity, const map_fn& map, const reduce_fn& reduce)
+        {
+            if(end - begin <= grain)
+            {
+                T acc = identity;
+                for(size_t i = begin; i < end; ++i)
+                    acc = reduce(acc, map(i));
+                return acc;
+            }
+            size_t mid = begin + (end - begin)/2;
+            T left = identity, right = identity;
+            spawn_join([&]{left = reduce_range(begin, mid, grain, identity, map, reduce);}, 
+            [&]{right = reduce_range(mid, end, grain, identity, map, reduce);});
+            return reduce(left, right);
+        }
+
+        void submit(job* j)
+        {
+            pendingJobs.fetch_add(1, std::memory_order_relaxed);
+            if(currentPool == this)
+                workers[currentWorker]->jobs.push(j);
+            else
+            {
+                std::lock_guard<std::mutex> lock(poolMutex);
+                jobQueue.push(j);
+                queuedJobs.fetch_add(1, std::memory_order_relaxed);
+            }
+            wake_one();
         }
     public:
         size_t count(){return threads.size();}
 
-        threadpool(unsigned int count = std::thread::hardware_concurrency()) 
+        threadpool(unsigned int count = std::thread::hardware_concurrency())
         {
+            // every deque must exist before the first worker starts stealing
+            workers.reserve(count + 1);
+            for(size_t i = 0; i < count + 1; ++i)
+                workers.push_back(std::make_unique<worker>(uint32_t(2654435761u * (i + 1))));
+
             threads.reserve(count);
             for(size_t i = 0; i < count; ++i)
-                threads.emplace_back(std::thread(&threadpool::loop, this));
+                threads.emplace_back(std::thread(&threadpool::loop, this, i));
         }
+        threadpool(const threadpool&) = delete;
+        threadpool& operator=(const threadpool&) = delete;
+
         void enqueue_job(const std::function<void()>& job)
         {
-            {
-                std::unique_lock<std::mutex> lock (poolMutex);
-                jobQueue.push(job);
-            }
-            mutexCond.notify_one();
+            submit(new function_job(job));
+        }
+
+        /**
+         * @brief Runs %a on the calling thread and %b as a job of the pool, and returns once both are done.
+         * %b is not copied or allocated, and while waiting for it the calling thread runs jobs itself.
+         * May be called from any thread, including from jobs of this pool.
+         */
+        template<typename fn_a, typename fn_b>
+        void fork_join(const fn_a& a, const fn_b& b)
+        {
+            as_worker([&]{spawn_join(a, b);});
+        }
+
+        /**
+         * @brief Calls %fn(i) for every i in [%begin, %end) in parallel, and returns once all calls are done.
+         * The range is halved recursively with fork_join() until at most %grain indices are left, so the whole loop
+         * allocates nothing. Pick %grain so that %grain calls take at least a few microseconds.
+         */
+        template<typename index_fn>
+        void parallel_for(size_t begin, size_t end, size_t grain, const index_fn& fn)
+        {
+            if(begin < end)
+                as_worker([&]{for_range(begin, end, std::max<size_t>(grain, 1), fn);});
         }
-        bool empty(){std::unique_lock<std::mutex> lock (poolMutex); return jobQueue.empty();}
-        
-        //this WILL destroy the object!
+
+        /**
+         * @brief Combines %map(i) for every i in [%begin, %end) with %reduce, which must be associative and have
+         * %identity as its identity. Split like parallel_for().
+         */
+        template<typename T, typename map_fn, typename reduce_fn>
+        [[nodiscard]] T parallel_reduce(size_t begin, size_t end, size_t grain, const T& identity, const map_fn& map, 
+        const reduce_fn& reduce)
+        {
+            T result = identity;
+            if(begin < end)
+                as_worker([&]{result = reduce_range(begin, end, std::max<size_t>(grain, 1), identity, map, reduce);});
+            return result;
+        }
+        /// @return true if every enqueued job has finished.
+        bool empty(){return pendingJobs.load(std::memory_order_acquire) == 0;}
+
+        //this WILL destroy the object! Jobs already enqueued are run first.
         void stop(){
-            {
-                std::unique_lock<std::mutex> lock (poolMutex);
-                shouldTerminate = true;
-            }
-            mutexCond.notify_all();
+            shouldTerminate.store(true, std::memory_order_release);
+            wakeEpoch.fetch_add(1, std::memory_order_release);
+            wakeEpoch.notify_all();
             for (std::thread& activeThread : threads)
                 activeThread.join();
             threads.clear();
         }
 
+        /**
+         * @brief Returns once every enqueued job has finished. The calling thread runs jobs until none are left to take,
+         * then blocks. Must not be called from a job of this pool.
+         */
         void wait_till_done()
         {
-
-            if(all_idle())
-                return;
-            else
-            {
-                std::unique_lock<std::mutex> lock (poolMutex);
-                idleCond.wait(lock, [this](){return activeThreads == 0 && jobQueue.empty();});
-            }
+            // jobs run here may fork, so only help while owning the guest deque
+            guest_scope guest(*this);
+            for(size_t pending; (pending = pendingJobs.load(std::memory_order_acquire)) != 0;)
+                if(job* j = guest.entered ? find_job(currentWorker) : nullptr)
+                    run(j);
+                else
+                    pendingJobs.wait(pending, std::memory_order_acquire);
         }
 
         ~threadpool(){stop();}
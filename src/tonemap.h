@@ -0,0 +1,141 @@
+#pragma once
+
+#include "format.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace AiCo
+{
+    /// @brief How radiance above 1 is brought into range: clipped, or compressed by Reinhard's x/(1+x) or the ACES fit.
+    enum class tonemap_curve{clamp, reinhard, aces};
+
+    /// @brief Radiance is scaled by %exposure, compressed by %curve, then encoded for display.
+    struct tonemap_settings
+    {
+        float exposure = 1.f;
+        /// Encodes with x^(1/gamma), unless %sRGB picks the sRGB transfer function instead.
+        float gamma = 2.f;
+        bool sRGB = false;
+        tonemap_curve curve = tonemap_curve::clamp;
+    };
+
+    /**
+     * @brief Converts linear radiance to RGBA32 in batches, simd::WIDTH channels at a time.
+     *
+     * Encoding is a table lookup indexed by the exponent and top mantissa bits of the tonemapped value. Its entries are
+     * spaced logarithmically, dense where the gamma curve is steep, and no pow() is left per pixel. The result is within
+     * one code of colorftoRGBA32(gamma(...)), and black stays black.
+     */
+    class tonemapper
+    {
+    public:
+        explicit tonemapper(const tonemap_settings& settings = {}) : settings(settings), table(TABLE_SIZE + 3, 0)
+        {
+            assert(settings.gamma > 0.f);
+            for(uint32_t i = 0; i < TABLE_SIZE; ++i)
+            {
+                // the middle of the values sharing entry i. The last entry is 1 alone
+                uint32_t lowBits = (MIN_INDEX + i) << SHIFT, highBits = (MIN_INDEX + i + 1) << SHIFT;
+                float low, high;
+                std::memcpy(&low, &lowBits, sizeof(low));
+                std::memcpy(&high, &highBits, sizeof(high));
+                float v = i + 1 == TABLE_SIZE ? 1.f : 0.5f * (low + high);
+                table[i] = uint8_t(std::clamp(encode(v) * 255.f + 0.5f, 0.f, 255.f));
+            }
+        }
+
+        /// @return The tonemapper the renderers use unless told otherwise: gamma 2, clipped.
+        [[nodiscard]] static const tonemapper& standard()
+        {
+            static const tonemapper op;
+            return op;
+        }
+
+        [[nodiscard]] const tonemap_settings& config()const{return settings;}
+
+        /// @brief Writes %n pixels of %radiance, times %scale, to %out.
+        void operator()(const color3f* radiance, size_t n, RGBA32* out, float scale = 1.f)const
+        {
+            using namespace simd;
+            const vfloat exposure = set1(settings.exposure * scale);
+            const vint alpha = set1(int32_t(0xff000000u));
+
+            alignas(64) float r[WIDTH], g[WIDTH], b[WIDTH];
+            alignas(64) int32_t packed[WIDTH];
+            for(size_t i = 0; i < n; i += WIDTH)
+            {
+                const size_t count = std::min(WIDTH, n - i);
+                for(size_t k = 0; k < count; ++k)
+                {
+                    r[k] = radiance[i + k].r;
+                    g[k] = radiance[i + k].g;
+                    b[k] = radiance[i + k].b;
+                }
+                for(size_t k = count; k < WIDTH; ++k)
+                    r[k] = g[k] = b[k] = 0.f;
+
+                vint R = quantize(curve(load(r) * exposure));
+                vint G = quantize(curve(load(g) * exposure));
+                vint B = quantize(curve(load(b) * exposure));
+                storeu(packed, R | (G << 8) | (B << 16) | alpha);
+                // RGBA32 is r, g, b, a in memory, the bytes of a little endian r | g << 8 | b << 16 | a << 24
+                std::memcpy(out + i, packed, count * sizeof(RGBA32));
+            }
+        }
+
+    private:
+        tonemap_settings settings;
+        std::vector<uint8_t> table;
+
+        /// Mantissa bits kept in the index. With 8, neighbouring entries differ by under a third of a code.
+        static constexpr uint32_t MANTISSA_BITS = 8, SHIFT = 23 - MANTISSA_BITS;
+        /// Smallest value told apart from 0: 2^-24, far below what even gamma 2.4 encodes to a code above 0.
+        static constexpr uint32_t MIN_INDEX = (127 - 24) << MANTISSA_BITS;
+        /// 24 octaves, and 1.
+        static constexpr uint32_t TABLE_SIZE = (24 << MANTISSA_BITS) + 1;
+
+        [[nodiscard]] float encode(float v)const
+        {
+            if(!settings.sRGB)
+                return std::pow(v, 1.f/settings.gamma);
+            return v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.f/2.4f) - 0.055f;
+        }
+
+        [[nodiscard]] simd::vfloat curve(simd::vfloat x)const
+        {
+            using namespace simd;
+            switch(settings.curve)
+            {
+            case tonemap_curve::reinhard:
+                x = max(x, set1(0.f));
+                return x / (x + set1(1.f));
+            case tonemap_curve::aces:
+                // Narkowicz's fit of the ACES filmic curve, "ACES Filmic Tone Mapping Curve" (2015)
+                x = max(x, set1(0.f));
+                return (x * fmadd(set1(2.51f), x, set1(0.03f))) / fmadd(x, fmadd(set1(2.43f), x, set1(0.59f)), set1(0.14f));
+            case tonemap_curve::clamp:
+            default:
+                return x;
+            }
+        }
+
+        /// @return The table entry of %v, clamped to [0, 1]. NaN maps to 0.
+        [[nodiscard]] simd::vint quantize(simd::vfloat v)const
+        {
+            using namespace simd;
+            constexpr uint32_t minBits = MIN_INDEX << SHIFT;
+            float minValue;
+            std::memcpy(&minValue, &minBits, sizeof(minValue));
+            // max() returns its second operand for NaN
+            v = min(max(v, set1(minValue)), set1(1.f));
+            return gather_u8(table.data(), (as_int(v) >> SHIFT) - set1(int32_t(MIN_INDEX)));
+        }
+    };
+}
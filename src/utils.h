@@ -5,10 +5,10 @@
 
 #include <cstdlib>
 #include <limits>
-#include <random>
 
 #include "interval.h"
 #include "format.h"
+#include "rng.h"
 
 namespace AiCo 
 {
@@ -20,62 +20,19 @@ namespace AiCo
     [[nodiscard]] glm::vec<L, T> lerp (float alpha, glm::vec<L, T> a, glm::vec<L, T> b) {return (1-alpha)*a + (alpha)*b;}
     
 
-    inline float fast_rand()
-    {
-        static thread_local std::minstd_rand RNG;
-        std::uniform_real_distribution<float> dist(0.f, 1.f);
-        return dist(RNG);
-    }
-
     /**
      * @brief Returns random number in [0, 1[
-     * thread-safe.
+     * thread-safe. Draws the next dimension of the thread's sample_context, see rng.h.
      */
-    inline float rand()
-    {   //high quality, but slow 
-        return fast_rand(); //XXX testing
-        static thread_local std::mt19937 RNG(std::random_device{}());
-        std::uniform_real_distribution<float> dist(0.f, 1.f);
-        return dist(RNG);
-    }
+    inline float rand(){return next_rand();}
 
     inline float rand(interval K){return K.min + (K.max - K.min)*AiCo::rand();}
     
     inline glm::vec3 randvec(){return glm::vec3(rand(), rand(), rand());}
     inline glm::vec3 randvec(interval K){return glm::vec3(rand(K), rand(K), rand(K));}
     
-    // TODO for fuck's sake this function is 25% of the frametime. 
-    // for god's sake please implement spherical coordinate sampling!
-    [[nodiscard]] inline glm::vec3 randvec_on_unit_sphere()
-    {
-        while (true)
-        {
-            auto candidate = randvec({-1.f, 1.f});
-            auto length = glm::length(candidate);
-            if (length <= 1.f && length > std::numeric_limits<float>::min())
-                return glm::normalize(candidate);
-        }
-    }   
-    [[nodiscard]] inline glm::vec2 randvec_in_unit_disk()
-    {
-        while(true)
-        {
-            glm::vec2 candidate{rand({-1, 1}), rand({-1, 1})};
-            auto length = glm::length(candidate);
-            if(length <= 1.f && length > std::numeric_limits<float>::min())
-                return candidate;
-        }
-    }
-    
-    [[nodiscard]] inline glm::vec3 randvec_on_hemisphere(glm::vec3 surface_outward_normal)
-    {
-        auto candidate = randvec_on_unit_sphere();
-        if(glm::dot(candidate, surface_outward_normal) > 0.f)
-            return candidate;
-        else
-            return -candidate;
-    }
-    
+    // sampling of disks, spheres and hemispheres lives in sampling.h
+
     template<glm::length_t len>
     [[nodiscard]] inline bool nearzero_vec(glm::vec<len, float> u, float precision = 1e-8){return interval(-precision, precision).contains(u);}
     [[nodiscard]] inline color3f gamma(color3f color, float gammanum)
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "aligned.h"
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace AiCo
+{
+    /**
+     * @brief Chase-Lev work-stealing deque of pointers. The owning thread pushes and takes at the bottom without locking,
+     * any other thread may steal from the top.
+     *
+     * The ring buffer doubles when full. Replaced buffers are kept until the deque is destroyed, since a thief may still
+     * be reading from them. Memory orderings follow Lê et al., "Correct and Efficient Work-Stealing for Weak Memory
+     * Models" (PPoPP 2013).
+     */
+    template<typename T>
+    class work_deque
+    {
+    public:
+        /// %capacity must be a power of two.
+        explicit work_deque(size_t capacity = 1024)
+        {
+            assert(capacity != 0 && (capacity & (capacity - 1)) == 0);
+            buffers.push_back(std::make_unique<ring>(capacity));
+            buffer.store(buffers.back().get(), std::memory_order_relaxed);
+        }
+        work_deque(const work_deque&) = delete;
+        work_deque& operator=(const work_deque&) = delete;
+
+        /// @brief Owner thread only.
+        void push(T* item)
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed);
+            int64_t t = top.load(std::memory_order_acquire);
+            ring* r = buffer.load(std::memory_order_relaxed);
+            if(b - t > int64_t(r->mask))
+                r = grow(r, t, b);
+            r->put(b, item);
+            bottom.store(b + 1, std::memory_order_release);
+        }
+
+        /// @brief Owner thread only. @return The most recently pushed item, nullptr if empty.
+        [[nodiscard]] T* take()
+        {
+            int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+            ring* r = buffer.load(std::memory_order_relaxed);
+            bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t t = top.load(std::memory_order_relaxed);
+
+            if(t > b)
+            {
+                bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            T* item = r->get(b);
+            if(t == b)
+            {
+                // last item, race the thieves for it
+                if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                    item = nullptr;
+                bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return item;
+        }
+
+        /// @brief Any thread. @return The oldest item, nullptr if empty or if another thread won the race for it.
+        [[nodiscard]] T* steal()
+        {
+            int64_t t = top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            int64_t b = bottom.load(std::memory_order_acquire);
+            if(t >= b)
+                return nullptr;
+
+            T* item = buffer.load(std::memory_order_acquire)->get(t);
+            if(!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                return nullptr;
+            return item;
+        }
+
+        /// @brief Only a hint when other threads are pushing or stealing.
+        [[nodiscard]] bool empty()const
+        {
+            return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct ring
+        {
+            size_t mask;
+            std::unique_ptr<std::atomic<T*>[]> items;
+
+            explicit ring(size_t capacity) : mask(capacity - 1), items(new std::atomic<T*>[capacity]) {}
+
+            inline T* get(int64_t i)const{return items[i & mask].load(std::memory_order_relaxed);}
+            inline void put(int64_t i, T* item){items[i & mask].store(item, std::memory_order_relaxed);}
+        };
+
+        ring* grow(ring* old, int64_t t, int64_t b)
+        {
+            buffers.push_back(std::make_unique<ring>(2 * (old->mask + 1)));
+            ring* r = buffers.back().get();
+            for(int64_t i = t; i < b; ++i)
+                r->put(i, old->get(i));
+            buffer.store(r, std::memory_order_release);
+            return r;
+        }
+
+        // thieves hammer top, the owner bottom. Keep them on separate cache lines
+        alignas(CACHE_LINE) std::atomic<int64_t> top{0};
+        alignas(CACHE_LINE) std::atomic<int64_t> bottom{0};
+        std::atomic<ring*> buffer;
+        /// Every buffer ever used, owned by the owner thread.
+        std::vector<std::unique_ptr<ring>> buffers;
+    };
+}
@@ -0,0 +1,85 @@
+#include "format.h"
+#include "image_io.h"
+#include "raster.h"
+#include "raytracing/bvh.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/material.h"
+#include "raytracing/pipeline.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+#include "registry.h"
+#include "timer.h"
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Rendering to a raster and writing it afterwards, against streaming tiles to each image format while rendering.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    int width = 1280, height = 720;
+    uint samplesPerPixel = 2;
+    if(argc > 2)
+        width = std::stoi(argv[1]), height = std::stoi(argv[2]);
+
+    registry<material_t> mat_registry;
+    auto METAL = mat_registry.add(new material_t{.scatter = metallic(),
+    .texture =[](const intersection_t&){return color3f{0.8f, 0.8f, 0.8f};}});
+
+    auto DIFFUSE = mat_registry.add(new material_t{.scatter = lambertian_diffuse(),
+    .texture = [](const intersection_t&){return color3f{0.5f, 0.5f, 0.5f};}});
+
+    std::vector<sphere> balls = {sphere(0.5f, {0.0f, 0.5f, -2.5f}, mat_registry[METAL]),
+    sphere(20.f, {0.0f, -20.5f, -2.f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {2.f, 0.0f, -4.5f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {0.f, 0.2f, -1.5f}, mat_registry[DIFFUSE])};
+    std::vector<const bounded_geometry*> scene;
+    for(const auto& ball : balls)
+        scene.push_back(&ball);
+    bvh sceneBVH(scene);
+
+    static_pipeline pipeline(sceneBVH, unbiased_tracer(10, {0.001f, 40.f}),
+    vFOV_camera(40.f, width, height, {-2.f, -2.f , -2.5f}, 0.2f, {3.f, 2.f, -1.f}));
+
+    std::printf("%dx%d, %u spp, %u threads\n", width, height, samplesPerPixel, renderer::thread_count());
+
+    micro_timer timer;
+    raster image(width, height);
+    renderer::render(image, pipeline, samplesPerPixel);
+    float renderMs = timer.clock().count()/1e+3f;
+    write_ppm("image_writer_bench_raster.ppm", image);
+    float writeMs = timer.clock().count()/1e+3f;
+    std::printf("%-16s %9.1f ms render %9.1f ms write\n", "raster + ppm", renderMs, writeMs);
+
+    for(const char* extension : {".ppm", ".png", ".pfm", ".exr"})
+    {
+        std::string path = std::string("image_writer_bench") + extension;
+        micro_timer streamTimer;
+        auto out = open_image(path, width, height, renderer::TILE_SIZE);
+        renderer::render(*out, pipeline, samplesPerPixel);
+        std::printf("%-16s %9.1f ms total\n", ("streamed " + std::string(extension)).c_str(), streamTimer.clock().count()/1e+3f);
+    }
+
+    // the streamed PPM should match the raster byte for byte
+    auto read = [](const char* path)
+    {
+        std::vector<char> bytes;
+        if(std::FILE* file = std::fopen(path, "rb"))
+        {
+            char buffer[1 << 16];
+            for(size_t n; (n = std::fread(buffer, 1, sizeof(buffer), file)) > 0;)
+                bytes.insert(bytes.end(), buffer, buffer + n);
+            std::fclose(file);
+        }
+        return bytes;
+    };
+    bool same = read("image_writer_bench_raster.ppm") == read("image_writer_bench.ppm");
+    std::printf("streamed ppm %s the raster\n", same ? "matches" : "DIFFERS from");
+    return same ? 0 : 1;
+}
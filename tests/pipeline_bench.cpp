@@ -0,0 +1,80 @@
+#include "format.h"
+#include "raster.h"
+#include "raytracing/bvh.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/material.h"
+#include "raytracing/pipeline.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+#include "raytracing/wavefront.h"
+#include "registry.h"
+#include "timer.h"
+
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+// Renders the raytracing_camera_test scene with the type erased and statically dispatched pipelines, and with the wavefront tracer.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    int width = 640, height = 360;
+    uint samplesPerPixel = 5, frames = 10;
+    if(argc > 2)
+        width = std::stoi(argv[1]), height = std::stoi(argv[2]);
+    if(argc > 3)
+        frames = std::stoi(argv[3]);
+
+    registry<material_t> mat_registry;
+    auto METAL = mat_registry.add(new material_t{.scatter = metallic(),
+    .texture =[](const intersection_t&){return color3f{0.8f, 0.8f, 0.8f};}});
+
+    auto DIFFUSE = mat_registry.add(new material_t{.scatter = lambertian_diffuse(),
+    .texture = [](const intersection_t&){return color3f{0.5f, 0.5f, 0.5f};}});
+
+    std::vector<sphere> balls = {sphere(0.5f, {0.0f, 0.5f, -2.5f}, mat_registry[METAL]),
+    sphere(20.f, {0.0f, -20.5f, -2.f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {2.f, 0.0f, -4.5f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {0.f, 0.2f, -1.5f}, mat_registry[DIFFUSE]),
+    sphere(0.5f, {0.5f, 0.5f, -3.f}, mat_registry[DIFFUSE]),
+    sphere(0.5f, {-0.5f, 0.f, -5.f}, mat_registry[DIFFUSE]),
+    sphere(0.1f, {1.5f, 0.3f, -1.5f}, mat_registry[METAL])};
+
+    std::vector<const bounded_geometry*> scene;
+    for(const auto& ball : balls)
+        scene.push_back(&ball);
+    bvh sceneBVH(scene);
+
+    unbiased_tracer tracer(10, {0.001f, 10.f});
+    vFOV_camera view(40.f, width, height, {-2.f, -2.f , -2.5f}, 0.2f, {3.f, 2.f, -1.f});
+
+    simple_pipeline erased(std::ref(sceneBVH), tracer, view);
+    static_pipeline inlined(sceneBVH, tracer, view);
+    wavefront_renderer wavefront(samplesPerPixel, sceneBVH, wavefront_tracer(10, {0.001f, 10.f}), view);
+
+    raster image(width, height);
+
+    auto bench = [&](const char* name, const auto& render)
+    {
+        render();  // warm up
+        micro_timer timer;
+        for(uint i = 0; i < frames; ++i)
+            render();
+        float seconds = timer.clock().count()/1e+6f;
+        double samples = double(width) * height * samplesPerPixel * frames;
+        std::printf("%-16s %8.2f Msamples/s  %8.2f ms/frame\n", name, samples/seconds/1e+6, 1e+3f * seconds/frames);
+    };
+
+    std::printf("%dx%d, %u spp, %u frames\n", width, height, samplesPerPixel, frames);
+    bench("simple_pipeline", [&]{renderer::render(image, erased, samplesPerPixel);});
+    bench("static_pipeline", [&]{renderer::render(image, inlined, samplesPerPixel);});
+    bench("wavefront", [&]{wavefront(image);});
+
+    return 0;
+}
@@ -0,0 +1,121 @@
+#include "format.h"
+#include "rasterizer.h"
+#include "rng.h"
+#include "threadpool.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Triangle fill rate of the rasterizer for small, medium and screen sized triangles.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+
+    int width = 1280, height = 720;
+    if(argc > 2)
+        width = std::stoi(argv[1]), height = std::stoi(argv[2]);
+    rasterizer R(width, height, {0.f, 1.f}, {0.f, 1.f});
+
+    struct triangle{glm::vec<2, int> a, b, c;};
+    const glm::vec<3, glm::vec3> colors = {{1.f, 0.2f, 0.2f}, {0.2f, 1.f, 0.2f}, {0.2f, 0.2f, 1.f}};
+
+    std::printf("%dx%d, simd width %zu\n", width, height, simd::WIDTH);
+    for(int size : {4, 16, 64, 256, 1024})
+    {
+        // random triangles of about %size pixels a side, all on screen
+        std::vector<triangle> triangles;
+        for(uint32_t i = 0; i < 20000; ++i)
+        {
+            glm::vec<2, int> center = {int(counter_rand(i, 0, 0, 0) * width), int(counter_rand(i, 0, 0, 1) * height)};
+            auto corner = [&](uint32_t k)
+            {
+                int x = center.x + int((counter_rand(i, k, 0, 0) - 0.5f) * size);
+                int y = center.y + int((counter_rand(i, k, 0, 1) - 0.5f) * size);
+                return glm::vec<2, int>(std::clamp(x, 0, width - 1), std::clamp(y, 0, height - 1));
+            };
+            triangles.push_back({corner(1), corner(2), corner(3)});
+        }
+        size_t count = std::max<size_t>(16, triangles.size() * 16 / size / size);
+        count = std::min(count, triangles.size());
+
+        R.clear({0, 0, 0, 255});
+        micro_timer timer;
+        for(size_t i = 0; i < count; ++i)
+            R.draw_triangle_scr(triangles[i].a, triangles[i].b, triangles[i].c, colors);
+        float us = timer.clock().count();
+
+        size_t covered = 0;
+        tile_span pixels = R.span();
+        for(size_t y = 0; y < pixels.height; ++y)
+            for(const RGBA32& pixel : pixels.row(y))
+                covered += pixel != RGBA32(0, 0, 0, 255);
+        std::printf("size %5d %6zu triangles %9.3f us/triangle %8.1f Mtriangles/s %6.1f%% of the screen covered\n",
+        size, count, us/count, count/us, 100.f * covered/(float(width) * height));
+    }
+
+    // a mesh of small triangles in world space, one draw_triangle_scr() at a time against draw_triangles(), which runs
+    // on the calling thread and one fewer workers than hardware threads
+    threadpool pool(std::max(1u, std::thread::hardware_concurrency()) - 1);
+    rasterizer W(width, height, {0.f, 1.f}, {0.f, 1.f}, {0.1f, 1.f});
+    W.set_camera_transform({0.f, 0.f, 0.f}, {0.f, 0.f, -1.f}, {0.f, 1.f, 0.f});
+    std::vector<vertex> vertices;
+    std::vector<uint32_t> indices;
+    for(uint32_t i = 0; i < 100000; ++i)
+    {
+        glm::vec3 center = {counter_rand(i, 0, 0, 0), counter_rand(i, 0, 0, 1), 0.3f + 0.4f * counter_rand(i, 0, 0, 2)};
+        for(uint32_t k = 0; k < 3; ++k)
+        {
+            glm::vec3 offset = {counter_rand(i, k + 1, 0, 0) - 0.5f, counter_rand(i, k + 1, 0, 1) - 0.5f, 0.f};
+            indices.push_back(uint32_t(vertices.size()));
+            vertices.push_back({center + 0.03f * offset, {counter_rand(i, k, 1, 0), counter_rand(i, k, 1, 1), counter_rand(i, k, 1, 2)}});
+        }
+    }
+
+    micro_timer timer;
+    for(size_t i = 0; i < indices.size(); i += 3)
+    {
+        const vertex &a = vertices[indices[i]], &b = vertices[indices[i + 1]], &c = vertices[indices[i + 2]];
+        W.draw_triangle_scr(W.toSCR(a.position), W.toSCR(b.position), W.toSCR(c.position), {a.color, b.color, c.color});
+    }
+    float serialMs = timer.clock().count()/1e+3f;
+    W.draw_triangles(vertices, indices, pool);
+    float batchedMs = timer.clock().count()/1e+3f;
+    std::printf("mesh %zu triangles: %9.2f ms one at a time %9.2f ms draw_triangles\n", indices.size()/3, serialMs, batchedMs);
+
+    // the mesh's corners as a point set, toSCR() one at a time against transform_points()
+    std::vector<glm::vec3> points;
+    for(const vertex& v : vertices)
+        points.push_back(v.position);
+    std::vector<glm::vec<2, int>> single(points.size()), batched(points.size());
+    timer = micro_timer();
+    for(size_t i = 0; i < points.size(); ++i)
+        single[i] = W.toSCR(points[i]);
+    float singleMs = timer.clock().count()/1e+3f;
+    W.transform_points(points, batched);
+    float pointsMs = timer.clock().count()/1e+3f;
+    size_t differing = 0;
+    for(size_t i = 0; i < points.size(); ++i)
+        differing += single[i] != batched[i];
+    std::printf("points %zu: %9.2f ms toSCR %9.2f ms transform_points, %zu differ by rounding\n", points.size(), singleMs,
+    pointsMs, differing);
+
+    // lines a hundred screens long through the screen, which should cost what is drawn of them
+    R.clear({0, 0, 0, 255});
+    const uint32_t nrLines = 10000;
+    timer = micro_timer();
+    for(uint32_t i = 0; i < nrLines; ++i)
+    {
+        glm::vec<2, int> through = {int(counter_rand(i, 0, 2, 0) * width), int(counter_rand(i, 0, 2, 1) * height)};
+        glm::vec<2, int> direction = {int((counter_rand(i, 1, 2, 0) - 0.5f) * 200.f * width),
+        int((counter_rand(i, 1, 2, 1) - 0.5f) * 200.f * height)};
+        R.draw_line_midpoint_scr(through - direction, through + direction, {255, 255, 255, 255});
+    }
+    float linesUs = timer.clock().count();
+    std::printf("long lines %u: %9.3f us/line\n", nrLines, linesUs/nrLines);
+    return 0;
+}
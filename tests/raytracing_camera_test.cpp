@@ -1,3 +1,4 @@
+#include "accumulation.h"
 #include "format.h"
 #include "raytracing/camera.h"
 #include "output.h"
@@ -5,11 +6,13 @@
 #include "raytracing/material.h"
 #include "timer.h"
 #include "raytracing/geometry.h"
+#include "raytracing/bvh.h"
 #include "raytracing/renderer.h"
 #include "raytracing/tracer.h"
 #include "raytracing/pipeline.h"
 #include "registry.h"
 #include "metrics.h"
+#include "sampler.h"
 
 #include <SDL_events.h>
 #include <SDL_video.h>
@@ -46,23 +49,30 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
     sphere rightBall(1.f, {2.f, 0.0f, -4.5f}, mat_registry[DIFFUSE]);
     sphere leftBall(1.f, {0.f, 0.2f, -1.5f}, mat_registry[DIFFUSE]);
 
-    std::vector<intersector_t> scene = {std::ref(smallBall), std::ref(bigBall), std::ref(rightBall), 
-    std::ref(leftBall), sphere(0.5f, {0.5f, 0.5f, -3.f}, mat_registry[DIFFUSE]),
+    std::vector<sphere> smallBalls = {sphere(0.5f, {0.5f, 0.5f, -3.f}, mat_registry[DIFFUSE]),
     sphere(0.5f, {-0.5f, 0.f, -5.f}, mat_registry[DIFFUSE]),
     sphere(0.1f, {1.5f, 0.3f, -1.5f}, mat_registry[METAL])};
+
+    std::vector<const bounded_geometry*> scene = {&smallBall, &bigBall, &rightBall, &leftBall};
+    for(const auto& ball : smallBalls)
+        scene.push_back(&ball);
+
+    threadpool bvhBuilder(1);
+    bvh sceneBVH(scene, &bvhBuilder);
     
     renderer R
     (
     5,
     simple_pipeline
         (
-        [&scene](ray R, interval K)
-            {return nearest_intersect(scene)(R, K);}, 
+        std::ref(sceneBVH), 
         unbiased_tracer(10, {0.001f, 10.f}),
         vFOV_camera(40.f, width, height, {-2.f, -2.f , -2.5f}, 0.2f,
             {3.f, 2.f, -1.f})
         )
     );
+    sobol_sampler sobol;
+    R.source = &sobol;
 
     micro_timer globalTimer;
 
@@ -73,16 +83,36 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
 
     unsigned int count = 0;   
 
+    // SPACE pauses the animation. While paused, samples accumulate and the image keeps converging, 
+    // spent adaptively on the pixels that are still noisy
+    accumulation_buffer accum(width, height);
+    adaptive_report report;
+    size_t totalSamples = 0;
+    bool paused = false;
+    double animationTime = 0.0;
+
     while(!quit)
     {
         SDL_Event e;
         while(SDL_PollEvent(&e))
             if(e.type == SDL_QUIT || e.window.event == SDL_WINDOWEVENT_CLOSE)
                 quit = true;
+            else if(e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_SPACE)
+                paused = !paused;
 
         micro_timer frameTimer;
 
-        R(WND.framebuffer);
+        if(paused)
+        {
+            report = R.render_adaptive(accum, R.samplesPerPixel, 0.02f);
+            totalSamples += report.samples;
+        }
+        else
+        {
+            R(accum);
+            totalSamples += size_t(width) * height * R.samplesPerPixel;
+        }
+        renderer::resolve(accum, WND.framebuffer);
 
         WNDR.write_frame();
         WND.write_frame();
@@ -92,19 +122,41 @@ int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
         auto inscts = INSCT_CNTR.load(std::memory_order_relaxed);
         auto engtime = float(globalTimer.time_since_start().count())/1000.f;
         
-        std::printf("ENGINE %0.2fms\nFRAME %0.2fms\nINSCT %lu\nINSCT/sec %0.1fM/s\n", 
+        auto frameTime = frameTimer.clock().count();
+
+        std::printf("ENGINE %0.2fms\nFRAME %0.2fms\nINSCT %lu\nINSCT/sec %0.1fM/s\nSPP %0.1f%s\n", 
         engtime,
-        float(frameTimer.clock().count())/1000.f, 
+        float(frameTime)/1000.f, 
         inscts, 
-        double(inscts/1e+3)/engtime);
+        double(inscts/1e+3)/engtime,
+        double(totalSamples)/(size_t(width) * height),
+        paused ? " (paused)   " : "           ");
+        if(paused)
+            std::printf("ERR mean %0.3f max %0.3f converged %0.1f%%    \n", report.meanError, report.maxError, 
+            100.f * report.convergedFraction);
+        else
+            std::printf("ERR -                                       \n");
+
+        // fraction of the paths that reach every bounce
+        std::printf("PATHS");
+        auto primaryPaths = PATH_DEPTH_CNTR[0].load(std::memory_order_relaxed);
+        for(size_t depth = 0; depth < 10 && primaryPaths != 0; ++depth)
+            std::printf(" %3.0f%%", 100.0 * PATH_DEPTH_CNTR[depth].load(std::memory_order_relaxed)/primaryPaths);
+        std::printf("\n");
         
         if(!quit)
-            std::printf("\033[F\033[F\033[F\033[F");
+            std::printf("\033[F\033[F\033[F\033[F\033[F\033[F\033[F");
+
+        if(paused)
+            continue;
         
-        smallBall.radius = map(cos(0.7 * double(globalTimer.time_since_start().count())/1e+6), {-1.f, 1.f}, 
-        {1.2f, 1.8f});
-        smallBall.center.x = cos(0.2f * 0.7 * double(globalTimer.time_since_start().count())/1e+6 + PI/2.f);
-        smallBall.center.y = cos(1.2f * 0.7 * double(globalTimer.time_since_start().count())/1e+6);
+        animationTime += double(frameTime)/1e+6;
+        smallBall.radius = map(cos(0.7 * animationTime), {-1.f, 1.f}, {1.2f, 1.8f});
+        smallBall.center.x = cos(0.2f * 0.7 * animationTime + PI/2.f);
+        smallBall.center.y = cos(1.2f * 0.7 * animationTime);
+        sceneBVH.refit({0});
+        accum.reset();
+        totalSamples = 0;
     }
     output::terminate();
     return 0;
@@ -0,0 +1,97 @@
+#include "accumulation.h"
+#include "format.h"
+#include "sampler.h"
+#include "raytracing/bvh.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/material.h"
+#include "raytracing/pipeline.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+#include "registry.h"
+#include "timer.h"
+
+#include <cmath>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// RMSE against a reference render, per sampler and samples per pixel, for the raytracing_camera_test scene.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    int width = 160, height = 90;
+    uint referenceSpp = 4096, maxSpp = 256;
+    if(argc > 2)
+        width = std::stoi(argv[1]), height = std::stoi(argv[2]);
+    if(argc > 3)
+        referenceSpp = std::stoi(argv[3]);
+
+    registry<material_t> mat_registry;
+    auto METAL = mat_registry.add(new material_t{.scatter = metallic(),
+    .texture =[](const intersection_t&){return color3f{0.8f, 0.8f, 0.8f};}});
+
+    auto DIFFUSE = mat_registry.add(new material_t{.scatter = lambertian_diffuse(),
+    .texture = [](const intersection_t&){return color3f{0.5f, 0.5f, 0.5f};}});
+
+    std::vector<sphere> balls = {sphere(0.5f, {0.0f, 0.5f, -2.5f}, mat_registry[METAL]),
+    sphere(20.f, {0.0f, -20.5f, -2.f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {2.f, 0.0f, -4.5f}, mat_registry[DIFFUSE]),
+    sphere(1.f, {0.f, 0.2f, -1.5f}, mat_registry[DIFFUSE]),
+    sphere(0.5f, {0.5f, 0.5f, -3.f}, mat_registry[DIFFUSE]),
+    sphere(0.5f, {-0.5f, 0.f, -5.f}, mat_registry[DIFFUSE]),
+    sphere(0.1f, {1.5f, 0.3f, -1.5f}, mat_registry[METAL])};
+
+    std::vector<const bounded_geometry*> scene;
+    for(const auto& ball : balls)
+        scene.push_back(&ball);
+    bvh sceneBVH(scene);
+
+    static_pipeline pipeline(sceneBVH, unbiased_tracer(10, {0.001f, 10.f}),
+    vFOV_camera(40.f, width, height, {-2.f, -2.f , -2.5f}, 0.2f, {3.f, 2.f, -1.f}));
+
+    // a differently seeded sobol_sampler converges fastest, and is independent of every sampler measured
+    micro_timer timer;
+    accumulation_buffer reference(width, height);
+    sobol_sampler referenceSampler(0xbeef);
+    renderer::render(reference, pipeline, referenceSpp, &referenceSampler);
+    std::printf("%dx%d, reference %u spp in %0.1fs\n", width, height, referenceSpp, timer.clock().count()/1e+6f);
+
+    accumulation_buffer accum(width, height);
+    auto rmse = [&]
+    {
+        double sum = 0.0;
+        for(size_t y = 0; y < size_t(height); ++y)
+            for(size_t x = 0; x < size_t(width); ++x)
+            {
+                color3f d = accum.mean(x, y) - reference.mean(x, y);
+                sum += d.r * d.r + d.g * d.g + d.b * d.b;
+            }
+        return std::sqrt(sum / (3.0 * width * height));
+    };
+
+    independent_sampler independent;
+    sobol_sampler sobol;
+    blue_noise_sampler blueNoise;
+
+    std::printf("%6s %12s %12s %12s %12s\n", "spp", "independent", "stratified", "sobol", "blue noise");
+    for(uint spp = 1; spp <= maxSpp; spp *= 2)
+    {
+        stratified_sampler stratified(spp);
+        const sampler* samplers[] = {&independent, &stratified, &sobol, &blueNoise};
+
+        std::printf("%6u", spp);
+        for(const sampler* source : samplers)
+        {
+            accum.reset();
+            renderer::render(accum, pipeline, spp, source);
+            std::printf(" %12.5f", rmse());
+        }
+        std::printf("\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,113 @@
+#include "aligned.h"
+#include "rng.h"
+#include "sampling.h"
+#include "timer.h"
+#include "utils.h"
+
+#include "glm/geometric.hpp"
+#include "glm/glm.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+#include <string>
+#include <vector>
+
+namespace
+{
+    using namespace AiCo;
+
+    // the rejection samplers sampling.h replaced, as the baseline
+    glm::vec3 rejection_sphere()
+    {
+        while (true)
+        {
+            auto candidate = randvec({-1.f, 1.f});
+            auto length = glm::length(candidate);
+            if (length <= 1.f && length > std::numeric_limits<float>::min())
+                return glm::normalize(candidate);
+        }
+    }
+    glm::vec2 rejection_disk()
+    {
+        while(true)
+        {
+            glm::vec2 candidate{rand({-1, 1}), rand({-1, 1})};
+            auto length = glm::length(candidate);
+            if(length <= 1.f && length > std::numeric_limits<float>::min())
+                return candidate;
+        }
+    }
+}
+
+// Samples per nanosecond of the rejection samplers and of the direct mappings, scalar and batched.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+
+    size_t n = 1 << 20;
+    if(argc > 1)
+        n = std::stoul(argv[1]);
+
+    aligned_vector<float> u0(n), u1(n), x(n), y(n), z(n);
+    for(size_t i = 0; i < n; ++i)
+        u0[i] = AiCo::rand(), u1[i] = AiCo::rand();
+
+    // every variant writes its samples to x, y, z. Their means, taken outside the timing, check the distributions
+    auto bench = [&](const char* name, const auto& run)
+    {
+        run();  // warm up
+        micro_timer timer;
+        run();
+        float ns = 1e+3f * timer.clock().count();
+
+        double sx = 0.0, sy = 0.0, sz = 0.0;
+        for(size_t i = 0; i < n; ++i)
+            sx += x[i], sy += y[i], sz += z[i];
+        std::printf("%-28s %8.3f samples/ns   mean (%6.3f, %6.3f, %6.3f)\n", name, n/ns, sx/n, sy/n, sz/n);
+    };
+    auto write = [&](size_t i, glm::vec3 d){x[i] = d.x; y[i] = d.y; z[i] = d.z;};
+
+    std::printf("%zu samples, simd width %zu\n", n, simd::WIDTH);
+
+    // counter-based rng, one number per sample index of one pixel
+    bench("counter rand scalar", [&]{for(size_t i = 0; i < n; ++i) x[i] = y[i] = z[i] = counter_rand(7, uint32_t(i), 0, 0);});
+    bench("counter rand batch", [&]
+    {
+        counter_rand(n, 7, 0, 0, 0, 0, x.data());
+        std::copy(x.begin(), x.end(), y.begin());
+        std::copy(x.begin(), x.end(), z.begin());
+    });
+
+    // rng included: the rejection samplers draw a varying number of numbers per sample
+    bench("sphere rejection + rng", [&]{for(size_t i = 0; i < n; ++i) write(i, rejection_sphere());});
+    bench("sphere direct + rng", [&]{for(size_t i = 0; i < n; ++i) write(i, sampling::uniform_sphere(sampling::rand2()));});
+    bench("disk rejection + rng", [&]{for(size_t i = 0; i < n; ++i) write(i, glm::vec3(rejection_disk(), 0.f));});
+    bench("disk concentric + rng", [&]
+    {
+        for(size_t i = 0; i < n; ++i) 
+            write(i, glm::vec3(sampling::concentric_disk(sampling::rand2()), 0.f));
+    });
+
+    // mapping only, from precomputed uniforms
+    bench("sphere direct scalar", [&]{for(size_t i = 0; i < n; ++i) write(i, sampling::uniform_sphere({u0[i], u1[i]}));});
+    bench("sphere direct batch", [&]{sampling::uniform_sphere(n, u0.data(), u1.data(), x.data(), y.data(), z.data());});
+    bench("disk concentric scalar", [&]
+    {
+        for(size_t i = 0; i < n; ++i)
+            write(i, glm::vec3(sampling::concentric_disk({u0[i], u1[i]}), 0.f));
+    });
+    bench("disk concentric batch", [&]
+    {
+        std::fill(z.begin(), z.end(), 0.f);
+        sampling::concentric_disk(n, u0.data(), u1.data(), x.data(), y.data());
+    });
+    bench("cosine hemisphere scalar", [&]
+    {
+        for(size_t i = 0; i < n; ++i)
+            write(i, sampling::cosine_hemisphere(glm::vec2{u0[i], u1[i]}));
+    });
+    bench("cosine hemisphere batch", [&]{sampling::cosine_hemisphere(n, u0.data(), u1.data(), x.data(), y.data(), z.data());});
+
+    return 0;
+}
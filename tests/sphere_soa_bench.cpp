@@ -0,0 +1,70 @@
+#include "raytracing/bvh.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/sphere_soa.h"
+#include "simd.h"
+#include "timer.h"
+#include "utils.h"
+
+#include <cstdio>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    size_t nrSpheres = 1000, nrRays = 100000;
+    if(argc > 2)
+        nrSpheres = std::stoul(argv[1]), nrRays = std::stoul(argv[2]);
+
+    material_t mat{};
+
+    std::vector<sphere> spheres;
+    sphere_soa soa;
+    spheres.reserve(nrSpheres);
+    soa.reserve(nrSpheres);
+    for(size_t i = 0; i < nrSpheres; ++i)
+    {
+        float radius = rand({0.05f, 0.3f});
+        glm::vec3 center = randvec({-20.f, 20.f});
+        spheres.emplace_back(radius, center, mat);
+        soa.add(radius, center, mat);
+    }
+
+    std::vector<intersector_t> scene;
+    std::vector<const bounded_geometry*> prims;
+    for(const auto& s : spheres)
+    {
+        scene.push_back(std::ref(s));
+        prims.push_back(&s);
+    }
+
+    std::vector<ray> rays;
+    rays.reserve(nrRays);
+    for(size_t i = 0; i < nrRays; ++i)
+        rays.emplace_back(randvec({-1.f, 1.f}), randvec({-25.f, 25.f}));
+
+    auto bench = [&rays](const char* name, const auto& insctr)
+    {
+        size_t hits = 0;
+        micro_timer timer;
+        for(const auto& R : rays)
+            if(insctr(R, {0.001f, 100.f}).has_value())
+                hits++;
+        float us = timer.clock().count();
+        std::printf("%-24s %10.1f ns/ray  %zu hits\n", name, 1e+3f * us/rays.size(), hits);
+    };
+
+    std::printf("%zu spheres, %zu rays, SIMD width %zu\n", nrSpheres, nrRays, simd::WIDTH);
+
+    bench("nearest_intersect", nearest_intersect(scene));
+    bench("sphere_soa", soa);
+    bench("bvh", bvh(prims));
+    bench("sphere_bvh", sphere_bvh(soa));
+
+    return 0;
+}
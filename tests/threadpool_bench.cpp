@@ -0,0 +1,90 @@
+#include "threadpool.h"
+#include "timer.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+
+namespace
+{
+    thread_local uint32_t sink = 0;
+
+    // a few nanoseconds of work, so that the bench measures the pool rather than the jobs
+    void tiny_job()
+    {
+        uint32_t x = sink + 1;
+        for(int i = 0; i < 16; ++i)
+        {
+            x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+        }
+        sink = x;
+    }
+}
+
+// Job throughput with tiny jobs, enqueued from outside the pool, from inside its workers, and forked by parallel_for.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+
+    unsigned int jobs = 1 << 18, maxThreads = 64;
+    if(argc > 1)
+        jobs = std::stoi(argv[1]);
+    if(argc > 2)
+        maxThreads = std::stoi(argv[2]);
+
+    std::printf("%u jobs per run\n%8s %16s %16s %20s\n", jobs, "threads", "external Mjobs/s", "nested Mjobs/s", 
+    "parallel_for Mjobs/s");
+    for(unsigned int count = 1; count <= maxThreads; count *= 2)
+    {
+        threadpool pool(count);
+
+        // every job enqueued by the calling thread
+        micro_timer timer;
+        for(unsigned int i = 0; i < jobs; ++i)
+            pool.enqueue_job(tiny_job);
+        pool.wait_till_done();
+        float external = jobs/float(timer.clock().count());
+
+        // one root job per worker, each enqueueing its share of the jobs from inside the pool
+        timer = micro_timer();
+        for(unsigned int root = 0; root < count; ++root)
+            pool.enqueue_job([&pool, share = jobs/count]()
+            {
+                for(unsigned int i = 0; i < share; ++i)
+                    pool.enqueue_job(tiny_job);
+            });
+        pool.wait_till_done();
+        float nested = (jobs/count*count + count)/float(timer.clock().count());
+
+        // one fork per index, the worst case for parallel_for
+        timer = micro_timer();
+        pool.parallel_for(0, jobs, 1, [](size_t){tiny_job();});
+        float forked = jobs/float(timer.clock().count());
+
+        size_t sum = pool.parallel_reduce(0, jobs, 64, size_t(0), [](size_t i){return i;}, std::plus<size_t>());
+        if(sum != size_t(jobs) * (jobs - 1)/2)
+            std::printf("parallel_reduce mismatch: %zu\n", sum);
+
+        std::printf("%8u %16.2f %16.2f %20.2f\n", count, external, nested, forked);
+    }
+
+    // two outside threads forking at once on a pool without workers, where only one can hold the guest deque
+    threadpool empty(0);
+    std::atomic<size_t> calls = 0;
+    std::atomic<int> started = 0;
+    auto fork = [&]
+    {
+        // the loops overlap, so the second one finds the guest deque taken
+        for(started.fetch_add(1); started.load() < 2;)
+            std::this_thread::yield();
+        empty.parallel_for(0, jobs, 1, [&](size_t){tiny_job(); calls.fetch_add(1, std::memory_order_relaxed);});
+    };
+    std::thread first(fork), second(fork);
+    first.join();
+    second.join();
+    std::printf("two callers without workers: %zu of %u calls\n", calls.load(), 2 * jobs);
+    return calls.load() == 2 * size_t(jobs) ? 0 : 1;
+}
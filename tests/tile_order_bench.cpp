@@ -0,0 +1,136 @@
+#include "format.h"
+#include "perf_counter.h"
+#include "raster.h"
+#include "raytracing/bvh.h"
+#include "raytracing/camera.h"
+#include "raytracing/geometry.h"
+#include "raytracing/intersection.h"
+#include "raytracing/material.h"
+#include "raytracing/pipeline.h"
+#include "raytracing/renderer.h"
+#include "raytracing/tracer.h"
+#include "registry.h"
+#include "timer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Frame time, cache misses per tile and worker affinity of the renderer's tiles, per tile order and size.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+    using namespace RT;
+
+    int width = 640, height = 360;
+    uint samplesPerPixel = 2, frames = 3;
+    if(argc > 2)
+        width = std::stoi(argv[1]), height = std::stoi(argv[2]);
+    if(argc > 3)
+        frames = std::stoi(argv[3]);
+
+    registry<material_t> mat_registry;
+    auto METAL = mat_registry.add(new material_t{.scatter = metallic(),
+    .texture =[](const intersection_t&){return color3f{0.8f, 0.8f, 0.8f};}});
+
+    auto DIFFUSE = mat_registry.add(new material_t{.scatter = lambertian_diffuse(),
+    .texture = [](const intersection_t&){return color3f{0.5f, 0.5f, 0.5f};}});
+
+    // enough spheres that the BVH no longer fits in the first cache levels
+    std::vector<sphere> balls = {sphere(20.f, {0.0f, -20.5f, -2.f}, mat_registry[DIFFUSE])};
+    for(uint32_t i = 0; i < 20000; ++i)
+    {
+        glm::vec3 center = {counter_rand(i, 0, 0, 0) * 40.f - 20.f, counter_rand(i, 0, 0, 1) * 3.f - 0.5f,
+        -counter_rand(i, 0, 0, 2) * 40.f - 1.f};
+        balls.emplace_back(0.05f + 0.2f * counter_rand(i, 0, 0, 3), center, mat_registry[i % 4 ? DIFFUSE : METAL]);
+    }
+
+    std::vector<const bounded_geometry*> scene;
+    for(const auto& ball : balls)
+        scene.push_back(&ball);
+    bvh sceneBVH(scene);
+
+    static_pipeline pipeline(sceneBVH, unbiased_tracer(10, {0.001f, 40.f}),
+    vFOV_camera(40.f, width, height, {-2.f, -2.f , -2.5f}, 0.2f, {3.f, 2.f, -1.f}));
+    raster image(width, height);
+
+    // one counter per worker thread, opened on first use
+    auto read_counters = [](uint64_t& llc, uint64_t& l1d)
+    {
+        static thread_local perf_counter llcMisses;
+        static thread_local perf_counter l1dMisses(perf_counter::L1D_READ_MISSES);
+        llc = llcMisses.read();
+        l1d = l1dMisses.read();
+        return llcMisses.valid();
+    };
+    {
+        uint64_t llc, l1d;
+        if(!read_counters(llc, l1d))
+            std::printf("perf counters unavailable (perf_event_paranoid, container or VM), misses read as 0\n");
+    }
+
+    auto bench = [&](const char* name, const std::vector<tile_rect>& tiles)
+    {
+        std::vector<uint64_t> llc(tiles.size()), l1d(tiles.size());
+        std::vector<size_t> workers(tiles.size());
+        auto renderFrame = [&]
+        {
+            renderer::for_each_tile(tiles, [&](size_t t)
+            {
+                uint64_t llc0, l1d0, llc1, l1d1;
+                read_counters(llc0, l1d0);
+                renderer::render_tile(span_of(image, tiles[t]), pipeline, samplesPerPixel);
+                read_counters(llc1, l1d1);
+                llc[t] = llc1 - llc0;
+                l1d[t] = l1d1 - l1d0;
+                workers[t] = std::hash<std::thread::id>{}(std::this_thread::get_id());
+            });
+        };
+
+        renderFrame();  // warm up
+        micro_timer timer;
+        for(uint i = 0; i < frames; ++i)
+            renderFrame();
+        float ms = timer.clock().count()/1e+3f/frames;
+
+        // counts of the last frame. Affinity: how often the next tile in the list ran on the same worker
+        double llcPerPixel = 0.0, l1dPerPixel = 0.0;
+        uint64_t llcMax = 0;
+        size_t sameWorker = 0;
+        for(size_t t = 0; t < tiles.size(); ++t)
+        {
+            llcPerPixel += double(llc[t]);
+            l1dPerPixel += double(l1d[t]);
+            llcMax = std::max(llcMax, llc[t]);
+            if(t + 1 < tiles.size())
+                sameWorker += workers[t] == workers[t + 1];
+        }
+        llcPerPixel /= double(width) * height;
+        l1dPerPixel /= double(width) * height;
+        std::printf("%-20s %5zu tiles %9.1f ms/frame %9.1f LLC/px %9.1f L1D/px %10lu max LLC/tile %6.1f%% affinity\n",
+        name, tiles.size(), ms, llcPerPixel, l1dPerPixel, (unsigned long)llcMax,
+        tiles.size() > 1 ? 100.0 * sameWorker/(tiles.size() - 1) : 100.0);
+    };
+
+    std::printf("%dx%d, %u spp, %u frames, %zu spheres\n", width, height, samplesPerPixel, frames, balls.size());
+
+    // what the renderer used to do: sqrt(20 * threads) rows and columns in scan order
+    unsigned int count = 20 * std::max(1u, std::thread::hardware_concurrency());
+    unsigned int nrRows = std::sqrt(count), nrCols = (count + nrRows - 1)/nrRows;
+    bench("grid 20*threads", tile_rects(width, height, nrRows, nrCols));
+
+    for(unsigned int size : {16u, 32u, 64u})
+    {
+        std::string suffix = " " + std::to_string(size);
+        bench(("scanline" + suffix).c_str(), square_tiles(width, height, size, tile_order::scanline));
+        bench(("morton" + suffix).c_str(), square_tiles(width, height, size, tile_order::morton));
+        bench(("hilbert" + suffix).c_str(), square_tiles(width, height, size, tile_order::hilbert));
+    }
+
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "format.h"
+#include "rng.h"
+#include "timer.h"
+#include "tonemap.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+// Throughput of tonemapper against per pixel gamma() and colorftoRGBA32(), and how far its codes are from exact ones.
+int main([[maybe_unused]]int argc, [[maybe_unused]]char** argv)
+{
+    using namespace AiCo;
+
+    size_t n = argc > 1 ? std::stoul(argv[1]) : 3840 * 2160;
+    const int repeats = 5;
+
+    // radiance spread over several stops, some of it above 1, and some exact black
+    std::vector<color3f> radiance(n);
+    for(uint32_t i = 0; i < n; ++i)
+        for(int c = 0; c < 3; ++c)
+            radiance[i][c] = i % 97 == 0 ? 0.f : 4.f * std::pow(counter_rand(i, 0, 0, c), 3.f);
+    std::vector<RGBA32> out(n), reference(n);
+
+    auto bench = [&](const char* name, auto&& fn)
+    {
+        fn();
+        micro_timer timer;
+        for(int r = 0; r < repeats; ++r)
+            fn();
+        std::printf("%-24s %8.2f ns/pixel\n", name, timer.clock().count() * 1e+3f/(float(repeats) * n));
+    };
+    auto maxDifference = [&]
+    {
+        int worst = 0;
+        for(size_t i = 0; i < n; ++i)
+            for(int c = 0; c < 4; ++c)
+                worst = std::max(worst, std::abs(int(out[i][c]) - int(reference[i][c])));
+        return worst;
+    };
+
+    std::printf("%zu pixels, %d repeats, simd width %zu\n", n, repeats, simd::WIDTH);
+
+    bench("gamma + colorftoRGBA32", [&]
+    {
+        for(size_t i = 0; i < n; ++i)
+            reference[i] = colorftoRGBA32(gamma(glm::clamp(radiance[i], 0.f, 1.f), 2.f));
+    });
+
+    const tonemapper& standard = tonemapper::standard();
+    bench("tonemapper clamp", [&]{standard(radiance.data(), n, out.data());});
+    std::printf("%24s max difference %d codes\n", "", maxDifference());
+
+    tonemapper sRGB({.sRGB = true});
+    for(size_t i = 0; i < n; ++i)
+        for(int c = 0; c < 3; ++c)
+        {
+            float v = std::clamp(radiance[i][c], 0.f, 1.f);
+            v = v <= 0.0031308f ? 12.92f * v : 1.055f * std::pow(v, 1.f/2.4f) - 0.055f;
+            reference[i][c] = uint8_t(v * 255.f + 0.5f);
+        }
+    bench("tonemapper sRGB", [&]{sRGB(radiance.data(), n, out.data());});
+    std::printf("%24s max difference %d codes\n", "", maxDifference());
+
+    tonemapper reinhard({.exposure = 2.f, .curve = tonemap_curve::reinhard});
+    bench("tonemapper reinhard", [&]{reinhard(radiance.data(), n, out.data());});
+    tonemapper aces({.exposure = 0.8f, .curve = tonemap_curve::aces});
+    bench("tonemapper aces", [&]{aces(radiance.data(), n, out.data());});
+
+    return 0;
+}